@@ -0,0 +1,284 @@
+/*
+*   Per host tuning of the transfer loops
+*/
+
+#include "autotune.h"
+#include "imagefile.h"
+#include "moments.h"
+#include "scheduler.h"
+
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <vector>
+#include <chrono>
+#include <thread>
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <unistd.h>
+
+using namespace std;
+
+/*
+   The kernels autotune chooses among: every per-pixel lαβ kernel, all
+   within one level per channel of the reference (ctbench). The reference
+   itself is never faster, and the ycbcr, cielab and oklab kernels give
+   other results. The -unique kernels are within a level of their
+   per-pixel twins but are only faster on images with few colors, which
+   the synthetic images, like photographs, are not, so they are left to
+   -kernel.
+*/
+static const char *TUNEKERNELS[] = {"fast", "fast-high", "fast-medium", "fast-low", "float",
+                                    "fixed"};
+static const long TUNEPIECES[] = {1 << 14, 1 << 16, 1 << 18, 1 << 20};
+
+// size of the synthetic images, the source scaled up to the destination as in a transfer
+const int TUNESOURCEWIDTH = 768, TUNESOURCEHEIGHT = 512;
+const int TUNEDESTWIDTH = 1024, TUNEDESTHEIGHT = 768;
+const int TUNEREPEATS = 2;   // the best of this many runs counts
+
+static int cores(){
+  return max(int(thread::hardware_concurrency()), 1);
+}
+
+Tuning defaulttuning(){
+  Tuning tuning = {"fast", cores(), 1 << 16};
+  return tuning;
+}
+
+void tunedstats(const Tuning &tuning, const TransferKernel *kernel, const Pixel *pixels, long n,
+                LabStats &stats){
+  long piece = max(tuning.piecepixels, 1L);
+  vector<LabStats> parts((n + piece - 1) / piece);
+  parallelpieces(n, piece, tuning.threads, [&](long start, long count){
+    kernel->stats(pixels + start, count, parts[start / piece]);
+  });
+  stats.count = 0;
+  for(int c = 0; c < 3; c++)
+    stats.mean[c] = stats.m2[c] = 0;
+  for(size_t k = 0; k < parts.size(); k++)
+    mergestats(stats, parts[k]);
+}
+
+void tunedapply(const Tuning &tuning, const ColorTransfer &transfer, const Pixel *pixels,
+                Pixel *result, long n){
+  parallelpieces(n, tuning.piecepixels, tuning.threads, [&](long start, long count){
+    transfer.apply(pixels + start, result + start, count);
+  });
+}
+
+void tunedapply(const Tuning &tuning, const ColorTransfer &transfer, const LabImage &image,
+                Pixel *result){
+  parallelpieces(long(image.stats.count), tuning.piecepixels, tuning.threads,
+                 [&](long start, long count){
+    transfer.apply(image, start, count, result + start);
+  });
+}
+
+/*
+   Smooth gradients with some noise from a fixed generator, so that every
+   run tunes on the same pixels and the palette is not tiny.
+*/
+static vector<Pixel> syntheticimage(int width, int height, unsigned seed){
+  vector<Pixel> pixels(long(width) * height);
+  for(int y = 0; y < height; y++)
+    for(int x = 0; x < width; x++){
+      seed = seed * 1103515245 + 12345;
+      int noise = int(seed >> 27) - 16;
+      Pixel &p = pixels[long(y) * width + x];
+      p.r = (unsigned char)min(max(255 * x / width + noise, 0), 255);
+      p.g = (unsigned char)min(max(255 * y / height - noise, 0), 255);
+      p.b = (unsigned char)min(max(255 * (x + y) / (width + height) + noise / 2, 0), 255);
+      p.a = 255;
+    }
+  return pixels;
+}
+
+/*
+   Seconds a whole transfer of the synthetic images takes with a tuning:
+   the rescale of the source, the statistics of both images and the apply.
+   The best of TUNEREPEATS runs counts.
+*/
+static double timetransfer(const Tuning &tuning, const vector<Pixel> &source,
+                           const vector<Pixel> &dest, vector<Pixel> &result){
+  const TransferKernel *kernel = findkernel(tuning.kernel);
+  double best = 0;
+  for(int r = 0; r < TUNEREPEATS; r++){
+    auto start = chrono::steady_clock::now();
+    int width, height;
+    Pixel *scaled = scalepixmap(&source[0], TUNESOURCEWIDTH, TUNESOURCEHEIGHT,
+                                TUNEDESTWIDTH, TUNEDESTHEIGHT, width, height,
+                                tuning.threads, tuning.piecepixels);
+    LabStats sourcestats, deststats;
+    tunedstats(tuning, kernel, scaled, long(width) * height, sourcestats);
+    tunedstats(tuning, kernel, &dest[0], long(dest.size()), deststats);
+    ColorTransfer transfer(kernel);
+    transfer.setstats(sourcestats, deststats);
+    tunedapply(tuning, transfer, &dest[0], &result[0], long(dest.size()));
+    poolfree(scaled);
+    double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    if(r == 0 || seconds < best)
+      best = seconds;
+  }
+  return best;
+}
+
+/*
+   The kernel is chosen with every core busy, as transfers run; then the
+   thread count, from 1 doubling up to the cores; then the piece size.
+*/
+Tuning autotune(){
+  vector<Pixel> source = syntheticimage(TUNESOURCEWIDTH, TUNESOURCEHEIGHT, 1);
+  vector<Pixel> dest = syntheticimage(TUNEDESTWIDTH, TUNEDESTHEIGHT, 2);
+  vector<Pixel> result(dest.size());
+
+  Tuning best = defaulttuning();
+  double besttime = timetransfer(best, source, dest, result);
+  for(size_t k = 1; k < sizeof(TUNEKERNELS) / sizeof(TUNEKERNELS[0]); k++){
+    Tuning tuning = best;
+    tuning.kernel = TUNEKERNELS[k];
+    double seconds = timetransfer(tuning, source, dest, result);
+    if(seconds < besttime){
+      best = tuning;
+      besttime = seconds;
+    }
+  }
+
+  for(int threads = 1; threads < cores(); threads = min(2 * threads, cores())){
+    Tuning tuning = best;
+    tuning.threads = threads;
+    double seconds = timetransfer(tuning, source, dest, result);
+    if(seconds < besttime){
+      best = tuning;
+      besttime = seconds;
+    }
+  }
+
+  Tuning start = best;
+  for(size_t k = 0; k < sizeof(TUNEPIECES) / sizeof(TUNEPIECES[0]); k++){
+    Tuning tuning = start;
+    tuning.piecepixels = TUNEPIECES[k];
+    if(tuning.piecepixels == start.piecepixels)
+      continue;
+    double seconds = timetransfer(tuning, source, dest, result);
+    if(seconds < besttime){
+      best = tuning;
+      besttime = seconds;
+    }
+  }
+  return best;
+}
+
+string hostname(){
+  char name[256];
+  if(gethostname(name, sizeof(name)) != 0)
+    return "localhost";
+  name[sizeof(name) - 1] = '\0';
+  return name;
+}
+
+string homefile(const string &name){
+  const char *home = getenv("HOME");
+  return home && *home ? string(home) + "/" + name : name;
+}
+
+string tuningfile(){
+  return homefile(".colortransfer-tuning");
+}
+
+/*
+   After the header, a host file has a line for each host: its name, its
+   number of cores, then the fields.
+*/
+bool readhostline(const string &filename, const char *header, const string &host,
+                  string &fields){
+  ifstream file(filename.c_str());
+  string line;
+  if(!getline(file, line) || line != header)
+    return false;
+  while(getline(file, line)){
+    istringstream words(line);
+    string name;
+    int ncores;
+    if(!(words >> name >> ncores) || name != host)
+      continue;
+    if(ncores != cores())
+      return false;
+    getline(words >> ws, fields);
+    return true;
+  }
+  return false;
+}
+
+/*
+   The other hosts' lines are kept, and the file is replaced by renaming, so
+   that runs reading it at the same time see either the old or the new one.
+*/
+bool writehostline(const string &filename, const char *header, const string &host,
+                   const string &fields){
+  vector<string> lines;
+  ifstream old(filename.c_str());
+  string line;
+  if(getline(old, line) && line == header)
+    while(getline(old, line)){
+      istringstream words(line);
+      string name;
+      if(words >> name && name != host)
+        lines.push_back(line);
+    }
+  old.close();
+
+  string temporary = filename + "." + to_string(getpid());
+  FILE *file = fopen(temporary.c_str(), "w");
+  if(!file){
+    cerr << "Could not write " << filename << endl;
+    return false;
+  }
+  fprintf(file, "%s\n", header);
+  for(size_t i = 0; i < lines.size(); i++)
+    fprintf(file, "%s\n", lines[i].c_str());
+  fprintf(file, "%s %d %s\n", host.c_str(), cores(), fields.c_str());
+  bool written = !ferror(file);
+  if(fclose(file) != 0 || !written || rename(temporary.c_str(), filename.c_str()) != 0){
+    remove(temporary.c_str());
+    cerr << "Could not write " << filename << endl;
+    return false;
+  }
+  return true;
+}
+
+// the fields of a tuning are: kernel threads piecepixels
+bool readtuning(const string &filename, const string &host, Tuning &tuning){
+  string fields;
+  if(!readhostline(filename, TUNINGFILEHEADER, host, fields))
+    return false;
+  istringstream words(fields);
+  Tuning found;
+  if(!(words >> found.kernel >> found.threads >> found.piecepixels) ||
+     !findkernel(found.kernel) || found.threads < 1 || found.piecepixels < 1)
+    return false;
+  tuning = found;
+  return true;
+}
+
+bool writetuning(const string &filename, const string &host, const Tuning &tuning){
+  return writehostline(filename, TUNINGFILEHEADER, host,
+                       tuning.kernel + " " + to_string(tuning.threads) + " " +
+                       to_string(tuning.piecepixels));
+}
+
+Tuning hosttuning(bool retune){
+  string filename = tuningfile(), host = hostname();
+  Tuning tuning;
+  if(!retune && readtuning(filename, host, tuning))
+    return tuning;
+
+  cout << "Tuning for " << host << ", which takes a few seconds, into " << filename << "..."
+       << flush;
+  tuning = autotune();
+  cout << " kernel " << tuning.kernel << ", " << tuning.threads << " threads, "
+       << tuning.piecepixels << " pixel pieces" << endl;
+  writetuning(filename, host, tuning);
+  return tuning;
+}
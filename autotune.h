@@ -0,0 +1,86 @@
+/*
+*   Per host tuning of the transfer loops
+*
+*   Which kernel is fastest, and how many threads and how many pixels each
+*   takes at a time suit the statistics, apply and rescale loops, depend on
+*   the machine: its vector units, cores and caches. autotune times
+*   candidates on a synthetic image, choosing the kernel first and then the
+*   threads and piece size one after the other, and the choice is kept for
+*   each host in a small text file, so later runs on the host only read it.
+*
+*   The kernels tried are the per-pixel lαβ ones, which give the same
+*   results to within a level of 8 bit color per channel (ctbench), so the
+*   choice only changes the speed.
+*/
+
+#ifndef AUTOTUNE_H
+#define AUTOTUNE_H
+
+#include "transfer.h"
+
+#include <string>
+
+const char TUNINGFILEHEADER[] = "colortransfer-tuning 1";
+
+struct Tuning{
+  std::string kernel;   // kernel for transfers that do not name one
+  int threads;          // threads for the statistics, apply and rescale
+  long piecepixels;     // pixels a thread takes at a time
+};
+
+// Tuning that needs no measurement: kernel fast, a thread per core, 64K pixel pieces
+Tuning defaulttuning();
+
+// Time the candidates on this machine, which takes a few seconds
+Tuning autotune();
+
+// The name of this host, under which its tuning is kept
+std::string hostname();
+
+// $HOME/name, or name without a home directory
+std::string homefile(const std::string &name);
+
+// homefile(".colortransfer-tuning")
+std::string tuningfile();
+
+//
+// A host file starts with header and has a line for each host, with its
+// name, its number of cores and fields of its own. readhostline finds the
+// fields of host, and returns false if there are none or they were made
+// with a different number of cores. writehostline replaces them, keeping
+// the other hosts' lines.
+//
+bool readhostline(const std::string &filename, const char *header, const std::string &host,
+                  std::string &fields);
+bool writehostline(const std::string &filename, const char *header, const std::string &host,
+                   const std::string &fields);
+
+//
+// Read the tuning of host from filename. Returns false if the file has
+// none, or one made with a different number of cores or for a kernel that
+// no longer exists.
+//
+bool readtuning(const std::string &filename, const std::string &host, Tuning &tuning);
+
+// Keep the tuning of host in filename, replacing any it had. Returns false on failure.
+bool writetuning(const std::string &filename, const std::string &host, const Tuning &tuning);
+
+//
+// The tuning of this host from tuningfile(), tuning and saving it first if
+// there is none or retune is set. A note is printed when it tunes.
+//
+Tuning hosttuning(bool retune);
+
+//
+// The transfer loops, split into pieces of tuning.piecepixels on
+// tuning.threads threads. The statistics of the pieces are merged in
+// order.
+//
+void tunedstats(const Tuning &tuning, const TransferKernel *kernel, const Pixel *pixels, long n,
+                LabStats &stats);
+void tunedapply(const Tuning &tuning, const ColorTransfer &transfer, const Pixel *pixels,
+                Pixel *result, long n);
+void tunedapply(const Tuning &tuning, const ColorTransfer &transfer, const LabImage &image,
+                Pixel *result);
+
+#endif
@@ -0,0 +1,378 @@
+/*
+*   Transfers within a time budget
+*/
+
+#include "budget.h"
+#include "imagefile.h"
+
+#include <iostream>
+#include <sstream>
+#include <vector>
+#include <chrono>
+#include <functional>
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <unistd.h>
+
+using namespace std;
+
+// size of the synthetic images the costs are measured on
+const int COSTWIDTH = 768, COSTHEIGHT = 512;
+const int COSTREPEATS = 2;        // the best of this many runs counts
+const double NOREDUCTION = 1e3;   // loss of a reduction that could not be measured
+
+// how much more the coarse detail of the loss images weighs than the fine,
+// fitted to the reduction losses of photographs in ctbench -budgetreport
+const double NATURALSLOPE = 0.15;
+
+static double bestseconds(const function<void()> &run){
+  double best = 0;
+  for(int r = 0; r < COSTREPEATS; r++){
+    auto start = chrono::steady_clock::now();
+    run();
+    double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    if(r == 0 || seconds < best)
+      best = seconds;
+  }
+  return best;
+}
+
+// mean ΔE in 8-bit RGB of result against reference
+static double meandelta(const Pixel *reference, const Pixel *result, long n){
+  double sum = 0;
+  for(long i = 0; i < n; i++){
+    double dr = double(reference[i].r) - result[i].r;
+    double dg = double(reference[i].g) - result[i].g;
+    double db = double(reference[i].b) - result[i].b;
+    sum += sqrt(dr * dr + dg * dg + db * db);
+  }
+  return n > 0 ? sum / n : 0;
+}
+
+static void transferstats(const Tuning &tuning, const TransferKernel *kernel,
+                          const LabStats &sourcestats, const LabStats &deststats,
+                          const Pixel *pixels, Pixel *result, long n){
+  ColorTransfer transfer(kernel);
+  transfer.setstats(sourcestats, deststats);
+  tunedapply(tuning, transfer, pixels, result, n);
+}
+
+void sampledstats(const Tuning &tuning, const TransferKernel *kernel, const Pixel *pixels,
+                  int width, int height, int stride, LabStats &stats){
+  if(stride <= 1){
+    tunedstats(tuning, kernel, pixels, long(width) * height, stats);
+    return;
+  }
+  int rows = (height + stride - 1) / stride;
+  Pixel *sample = poolnew<Pixel>(long(width) * rows);
+  for(int k = 0; k < rows; k++){
+    const Pixel *row = pixels + long(k) * stride * width;
+    copy(row, row + width, sample + long(k) * width);
+  }
+  tunedstats(tuning, kernel, sample, long(width) * rows, stats);
+  poolfree(sample);
+}
+
+// a hash of a lattice point to -1 to 1
+static double latticevalue(int x, int y, unsigned seed){
+  unsigned h = seed * 0x9e3779b9u ^ unsigned(x) * 0x85ebca6bu ^ unsigned(y) * 0xc2b2ae35u;
+  h ^= h >> 15;
+  h *= 0x2c1b3c6du;
+  h ^= h >> 12;
+  return h / 2147483647.5 - 1;
+}
+
+/*
+   Value noise over octaves from 256 pixel cells down to single pixels,
+   each with an amplitude of its cell size to the NATURALSLOPE, so that
+   the image has detail at every scale, which is what reductions and
+   sampled scanlines lose.
+*/
+static double fractal(int x, int y, unsigned seed){
+  double sum = 0, total = 0;
+  for(int cell = 256; cell >= 1; cell /= 2){
+    int cx = x / cell, cy = y / cell;
+    double fx = double(x % cell) / cell, fy = double(y % cell) / cell;
+    fx = fx * fx * (3 - 2 * fx);
+    fy = fy * fy * (3 - 2 * fy);
+    double top = latticevalue(cx, cy + 1, seed) * (1 - fx) + latticevalue(cx + 1, cy + 1, seed) * fx;
+    double bottom = latticevalue(cx, cy, seed) * (1 - fx) + latticevalue(cx + 1, cy, seed) * fx;
+    double amplitude = pow(double(cell), NATURALSLOPE);
+    sum += amplitude * (bottom * (1 - fy) + top * fy);
+    total += amplitude;
+    seed++;
+  }
+  return sum / total;
+}
+
+/*
+   Losses are measured on a fractal luminance with weaker fractal color
+   and a gamma that darkens it, where the log of lαβ magnifies errors, as
+   in photographs. Smooth gradients would understate what a reduction or
+   sampled scanlines lose.
+*/
+static vector<Pixel> naturalimage(int width, int height, unsigned seed){
+  vector<Pixel> pixels(long(width) * height);
+  for(int y = 0; y < height; y++)
+    for(int x = 0; x < width; x++){
+      double luminance = 0.5 + 1.5 * fractal(x, y, seed);
+      double red = 0.4 * fractal(x, y, seed + 100), blue = 0.4 * fractal(x, y, seed + 200);
+      double rgb[3] = {luminance + red, luminance - 0.5 * (red + blue), luminance + blue};
+      unsigned char channel[3];
+      for(int c = 0; c < 3; c++)
+        channel[c] = (unsigned char)(255 * pow(min(max(rgb[c], 0.0), 1.0), 2.2) + 0.5);
+      Pixel &p = pixels[long(y) * width + x];
+      p.r = channel[0];
+      p.g = channel[1];
+      p.b = channel[2];
+      p.a = 255;
+    }
+  return pixels;
+}
+
+/*
+   The decode costs and the reduction losses come from the synthetic
+   source written as PNG and JPEG to a scratch directory under $TMPDIR, or
+   /tmp, so that a calibration cut short leaves nothing in the home
+   directory. If they cannot be written the decodes count as free and the
+   reductions are never chosen.
+*/
+static void calibratefiles(const Tuning &tuning, const vector<Pixel> &source,
+                           const vector<Pixel> &dest, const LabStats &deststats,
+                           CostModel &costs){
+  const TransferKernel *reference = findkernel("reference");
+  long n = long(dest.size());
+  costs.decodens = costs.writens = 0;
+  for(int r = 0; r < NBUDGETREDUCTIONS; r++){
+    costs.jpegns[r] = 0;
+    costs.reductionloss[r] = r == 0 ? 0 : NOREDUCTION;
+  }
+
+  const char *tmpdir = getenv("TMPDIR");
+  string scratch = string(tmpdir && *tmpdir ? tmpdir : "/tmp") + "/colortransfer-costs.XXXXXX";
+  if(!mkdtemp(&scratch[0])){
+    cerr << "Could not make a scratch directory, reductions are left out" << endl;
+    return;
+  }
+  string png = scratch + "/source.png", jpg = scratch + "/source.jpg";
+  bool written = false;
+  costs.writens = bestseconds([&](){
+    written = writepixmap(png, &source[0], COSTWIDTH, COSTHEIGHT);
+  }) * 1e9 / n;
+  if(written)
+    costs.decodens = bestseconds([&](){
+      int width, height;
+      poolfree(readpixmap(png, width, height));
+    }) * 1e9 / n;
+  remove(png.c_str());
+  if(!written || !writejpeg(jpg, &source[0], COSTWIDTH, COSTHEIGHT)){
+    cerr << "Could not measure decodes, reductions are left out" << endl;
+    rmdir(scratch.c_str());
+    return;
+  }
+
+  // losses against a transfer from the full decode of the same file
+  vector<Pixel> full(n), result(n);
+  for(int r = 0; r < NBUDGETREDUCTIONS; r++){
+    int reduce = BUDGETREDUCTIONS[r];
+    int minwidth = (COSTWIDTH + reduce - 1) / reduce, minheight = (COSTHEIGHT + reduce - 1) / reduce;
+    Pixel *pixmap = NULL;
+    int width = 0, height = 0, reduction = 0;
+    costs.jpegns[r] = bestseconds([&](){
+      poolfree(pixmap);
+      pixmap = readreducedpixmap(jpg, minwidth, minheight, width, height, reduction);
+    }) * 1e9 / n;
+    if(!pixmap || reduction != reduce){
+      costs.jpegns[r] = 0;
+      poolfree(pixmap);
+      continue;
+    }
+    LabStats sourcestats;
+    tunedstats(tuning, reference, pixmap, long(width) * height, sourcestats);
+    transferstats(tuning, reference, sourcestats, deststats, &dest[0],
+                  r == 0 ? &full[0] : &result[0], n);
+    costs.reductionloss[r] = r == 0 ? 0 : meandelta(&full[0], &result[0], n);
+    poolfree(pixmap);
+  }
+  remove(jpg.c_str());
+  rmdir(scratch.c_str());
+}
+
+/*
+   Every loss is against the reference kernel's transfer with the
+   statistics of all the pixels, and changes only the one choice.
+*/
+CostModel calibratecosts(const Tuning &tuning){
+  CostModel costs;
+  costs.threads = tuning.threads;
+  costs.piecepixels = tuning.piecepixels;
+
+  vector<Pixel> source = naturalimage(COSTWIDTH, COSTHEIGHT, 3);
+  vector<Pixel> dest = naturalimage(COSTWIDTH, COSTHEIGHT, 1000);
+  long n = long(dest.size());
+  vector<Pixel> full(n), result(n);
+  const TransferKernel *reference = findkernel("reference");
+  LabStats sourcestats, deststats;
+  tunedstats(tuning, reference, &source[0], n, sourcestats);
+  tunedstats(tuning, reference, &dest[0], n, deststats);
+  transferstats(tuning, reference, sourcestats, deststats, &dest[0], &full[0], n);
+
+  for(int k = 0; k < NBUDGETKERNELS; k++){
+    const TransferKernel *kernel = findkernel(BUDGETKERNELS[k]);
+    LabStats kernelsource, kerneldest;
+    costs.statsns[k] = bestseconds([&](){
+      tunedstats(tuning, kernel, &dest[0], n, kerneldest);
+    }) * 1e9 / n;
+    tunedstats(tuning, kernel, &source[0], n, kernelsource);
+    ColorTransfer transfer(kernel);
+    transfer.setstats(kernelsource, kerneldest);
+    costs.applyns[k] = bestseconds([&](){
+      tunedapply(tuning, transfer, &dest[0], &result[0], n);
+    }) * 1e9 / n;
+    costs.kernelloss[k] = meandelta(&full[0], &result[0], n);
+  }
+
+  for(int s = 0; s < NBUDGETSTRIDES; s++){
+    LabStats sampledsource, sampleddest;
+    sampledstats(tuning, reference, &source[0], COSTWIDTH, COSTHEIGHT, BUDGETSTRIDES[s],
+                 sampledsource);
+    sampledstats(tuning, reference, &dest[0], COSTWIDTH, COSTHEIGHT, BUDGETSTRIDES[s],
+                 sampleddest);
+    transferstats(tuning, reference, sampledsource, sampleddest, &dest[0], &result[0], n);
+    costs.strideloss[s] = meandelta(&full[0], &result[0], n);
+  }
+
+  calibratefiles(tuning, source, dest, deststats, costs);
+  return costs;
+}
+
+string costfile(){
+  return homefile(".colortransfer-costs");
+}
+
+/*
+   The fields of the costs are the threads and piece size, then the stats,
+   apply and loss of each kernel, the decode and loss of each reduction,
+   the decode and write of other files and the loss of each stride.
+*/
+bool readcosts(const string &filename, const string &host, const Tuning &tuning,
+               CostModel &costs){
+  string fields;
+  if(!readhostline(filename, COSTFILEHEADER, host, fields))
+    return false;
+  istringstream words(fields);
+  CostModel found;
+  if(!(words >> found.threads >> found.piecepixels) || found.threads != tuning.threads ||
+     found.piecepixels != tuning.piecepixels)
+    return false;
+  for(int k = 0; k < NBUDGETKERNELS; k++)
+    words >> found.statsns[k] >> found.applyns[k] >> found.kernelloss[k];
+  for(int r = 0; r < NBUDGETREDUCTIONS; r++)
+    words >> found.jpegns[r] >> found.reductionloss[r];
+  words >> found.decodens >> found.writens;
+  for(int s = 0; s < NBUDGETSTRIDES; s++)
+    words >> found.strideloss[s];
+  if(!words)
+    return false;
+  costs = found;
+  return true;
+}
+
+bool writecosts(const string &filename, const string &host, const CostModel &costs){
+  ostringstream fields;
+  fields << costs.threads << " " << costs.piecepixels;
+  for(int k = 0; k < NBUDGETKERNELS; k++)
+    fields << " " << costs.statsns[k] << " " << costs.applyns[k] << " " << costs.kernelloss[k];
+  for(int r = 0; r < NBUDGETREDUCTIONS; r++)
+    fields << " " << costs.jpegns[r] << " " << costs.reductionloss[r];
+  fields << " " << costs.decodens << " " << costs.writens;
+  for(int s = 0; s < NBUDGETSTRIDES; s++)
+    fields << " " << costs.strideloss[s];
+  return writehostline(filename, COSTFILEHEADER, host, fields.str());
+}
+
+CostModel hostcosts(const Tuning &tuning, bool recalibrate){
+  string filename = costfile(), host = hostname();
+  CostModel costs;
+  if(!recalibrate && readcosts(filename, host, tuning, costs))
+    return costs;
+
+  cout << "Calibrating costs for " << host << "..." << flush;
+  costs = calibratecosts(tuning);
+  cout << " done" << endl;
+  writecosts(filename, host, costs);
+  return costs;
+}
+
+/*
+   Every combination is estimated; they are ranked by loss, the faster
+   first where the losses are equal, so the first that fits is the answer.
+*/
+BudgetTier choosetier(const CostModel &costs, double budgetms, int sourcewidth,
+                      int sourceheight, bool sourcejpeg, int destwidth, int destheight,
+                      bool destjpeg){
+  double nsource = double(sourcewidth) * sourceheight, ndest = double(destwidth) * destheight;
+  double destdecode = ndest * (destjpeg ? costs.jpegns[0] : costs.decodens);
+  int reductions = sourcejpeg ? NBUDGETREDUCTIONS : 1;
+
+  vector<BudgetTier> tiers;
+  for(int k = 0; k < NBUDGETKERNELS; k++)
+    for(int r = 0; r < reductions; r++)
+      for(int s = 0; s < NBUDGETSTRIDES; s++){
+        if((r > 0 || s > 0) &&
+           ((sourceheight / BUDGETREDUCTIONS[r]) / BUDGETSTRIDES[s] < BUDGETMINROWS ||
+            destheight / BUDGETSTRIDES[s] < BUDGETMINROWS))
+          continue;
+        BudgetTier tier;
+        tier.kernel = findkernel(BUDGETKERNELS[k]);
+        tier.reduction = BUDGETREDUCTIONS[r];
+        tier.stride = BUDGETSTRIDES[s];
+        double sourcedecode = nsource * (sourcejpeg ? costs.jpegns[r] : costs.decodens);
+        double statspixels = (nsource / (tier.reduction * tier.reduction) + ndest) / tier.stride;
+        tier.ms = (destdecode + sourcedecode + costs.statsns[k] * statspixels +
+                   (costs.applyns[k] + costs.writens) * ndest) / 1e6;
+        tier.loss = costs.kernelloss[k] + costs.reductionloss[r] + costs.strideloss[s];
+        tier.fits = tier.ms <= budgetms;
+        tiers.push_back(tier);
+      }
+  stable_sort(tiers.begin(), tiers.end(), [](const BudgetTier &a, const BudgetTier &b){
+    return a.loss < b.loss || (a.loss == b.loss && a.ms < b.ms);
+  });
+
+  size_t fastest = 0;
+  for(size_t t = 0; t < tiers.size(); t++){
+    tiers[t].level = int(t);
+    tiers[t].levels = int(tiers.size());
+    if(tiers[t].ms < tiers[fastest].ms)
+      fastest = t;
+  }
+  for(size_t t = 0; t < tiers.size(); t++)
+    if(tiers[t].fits)
+      return tiers[t];
+  return tiers[fastest];
+}
+
+Pixel *tiertransfer(const Tuning &tuning, const BudgetTier &tier, const string &sourcefile,
+                    const string &destfile, int &width, int &height, int &reduction){
+  int sourcewidth, sourceheight;
+  if(!readimagesize(sourcefile, sourcewidth, sourceheight))
+    return NULL;
+  int sourcereadwidth, sourcereadheight;
+  Pixel *source = readreducedpixmap(sourcefile, (sourcewidth + tier.reduction - 1) / tier.reduction,
+                                    (sourceheight + tier.reduction - 1) / tier.reduction,
+                                    sourcereadwidth, sourcereadheight, reduction);
+  Pixel *dest = source ? readpixmap(destfile, width, height) : NULL;
+  if(!dest){
+    poolfree(source);
+    return NULL;
+  }
+  LabStats sourcestats, deststats;
+  sampledstats(tuning, tier.kernel, source, sourcereadwidth, sourcereadheight, tier.stride,
+               sourcestats);
+  sampledstats(tuning, tier.kernel, dest, width, height, tier.stride, deststats);
+  poolfree(source);
+  transferstats(tuning, tier.kernel, sourcestats, deststats, dest, dest, long(width) * height);
+  return dest;
+}
@@ -0,0 +1,128 @@
+/*
+*   Transfers within a time budget
+*
+*   A caller that must have its result by a deadline, such as a server
+*   answering a request, passes the time it can spend, and the transfer is
+*   made as close to the full quality one as fits. Each way of making it
+*   cheaper has a cost per pixel and a loss: the kernel, from the double
+*   reference through float to the fast and fixed kernels with their
+*   approximate or table-driven log and exp; decoding a JPEG source at 1/2,
+*   1/4 or 1/8 scale in the DCT, as -reduce does; and taking the statistics
+*   from every second, fourth, ... scanline. CostModel holds the time each
+*   takes on this host with its tuning (autotune.h) and the mean ΔE in RGB
+*   each puts in a transfer, measured on synthetic images and kept for each
+*   host in a small text file like the tuning. choosetier sets the estimated
+*   time of every combination, a tier, for the sizes of the images against
+*   the budget, and takes the one with the least loss that fits.
+*
+*   The losses are measured on fractal images with detail at every scale,
+*   and those of the three choices are added, so they are estimates for
+*   ranking the tiers rather than the error of a particular image, which
+*   ctbench -budgetreport shows for the images at hand. A tier must take
+*   the statistics from at least BUDGETMINROWS scanlines of each image.
+*/
+
+#ifndef BUDGET_H
+#define BUDGET_H
+
+#include "autotune.h"
+
+#include <string>
+
+const char COSTFILEHEADER[] = "colortransfer-costs 1";
+
+// the kernels, source reductions and scanline strides tiers are made of, best first
+const char *const BUDGETKERNELS[] = {"reference", "float", "fast-high", "fast", "fixed",
+                                     "fast-low"};
+const int NBUDGETKERNELS = 6;
+const int BUDGETREDUCTIONS[] = {1, 2, 4, 8};
+const int NBUDGETREDUCTIONS = 4;
+const int BUDGETSTRIDES[] = {1, 2, 4, 8, 16};
+const int NBUDGETSTRIDES = 5;
+const int BUDGETMINROWS = 64;   // scanlines of each image the statistics are taken from, at least
+
+//
+// What each choice costs on a host, in nanoseconds per pixel on the tuned
+// threads, and the mean ΔE in RGB it puts in a transfer against the full
+// quality one: the reference kernel from a full decode with the
+// statistics of every scanline.
+//
+struct CostModel{
+  int threads;                                // of the tuning it was measured with
+  long piecepixels;
+  double statsns[NBUDGETKERNELS];             // per pixel the statistics are taken from
+  double applyns[NBUDGETKERNELS];             // per destination pixel
+  double kernelloss[NBUDGETKERNELS];
+  double jpegns[NBUDGETREDUCTIONS];           // decode, per pixel of the full size JPEG
+  double decodens;                            // decode of other files, PNG as measured
+  double writens;                             // PNG write, per destination pixel
+  double reductionloss[NBUDGETREDUCTIONS];
+  double strideloss[NBUDGETSTRIDES];
+};
+
+//
+// A choice of kernel, source reduction and statistics stride, with its
+// estimated time and loss. level is its place among all the tiers the
+// images allow, from 0 for the full quality one, by loss.
+//
+struct BudgetTier{
+  const TransferKernel *kernel;
+  int reduction;    // the source is decoded at 1/reduction of its size
+  int stride;       // the statistics are taken from every stride-th scanline
+  double ms;
+  double loss;
+  int level, levels;
+  bool fits;        // the estimated time is within the budget
+};
+
+// Measure the costs with a tuning on synthetic images, which takes a second or so
+CostModel calibratecosts(const Tuning &tuning);
+
+// homefile(".colortransfer-costs")
+std::string costfile();
+
+//
+// Read the costs of host from filename. Returns false if the file has none,
+// or ones made with a different number of cores, threads or piece size.
+//
+bool readcosts(const std::string &filename, const std::string &host, const Tuning &tuning,
+               CostModel &costs);
+
+// Keep the costs of host in filename, replacing any it had. Returns false on failure.
+bool writecosts(const std::string &filename, const std::string &host, const CostModel &costs);
+
+//
+// The costs of this host with a tuning from costfile(), calibrating and
+// saving them first if there are none for it or recalibrate is set. A note
+// is printed when it calibrates.
+//
+CostModel hostcosts(const Tuning &tuning, bool recalibrate);
+
+//
+// The tier with the least estimated loss whose estimated time, for reading
+// a source and a destination of these sizes, transferring and writing the
+// result, is within budgetms, or the fastest if none is. Only a JPEG source
+// is decoded reduced.
+//
+BudgetTier choosetier(const CostModel &costs, double budgetms, int sourcewidth,
+                      int sourceheight, bool sourcejpeg, int destwidth, int destheight,
+                      bool destjpeg);
+
+//
+// The statistics of every stride-th scanline of a width x height pixmap,
+// from the bottom one, on the threads of a tuning
+//
+void sampledstats(const Tuning &tuning, const TransferKernel *kernel, const Pixel *pixels,
+                  int width, int height, int stride, LabStats &stats);
+
+//
+// Read a source and a destination file and transfer the destination as a
+// tier says: the source is decoded reduced, and the statistics of both are
+// taken from every stride-th scanline with the tier's kernel. Returns the
+// transferred destination, which the caller frees with poolfree, with its
+// size and the reduction the source was read at, or NULL on failure.
+//
+Pixel *tiertransfer(const Tuning &tuning, const BudgetTier &tier, const std::string &sourcefile,
+                    const std::string &destfile, int &width, int &height, int &reduction);
+
+#endif
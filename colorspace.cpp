@@ -0,0 +1,120 @@
+/*
+*   Color space matrices and tables
+*/
+
+#include "colorspace.h"
+#include "matrix.h"
+
+#include <cmath>
+
+using namespace std;
+
+/*
+   Round the matrices first and second, and their inverses, to float.
+   secondinverse and firstinverse are the exact inverses unless given.
+*/
+static void spacematrices(const Matrix3D &first, const Matrix3D &second, SpaceMatrices &m,
+                          const Matrix3D *secondinverse = NULL,
+                          const Matrix3D *firstinverse = NULL){
+  Matrix3D mats[4] = {first, second, secondinverse ? *secondinverse : second.inverse(),
+                      firstinverse ? *firstinverse : first.inverse()};
+  float (*out[4])[3] = {m.first, m.second, m.secondinverse, m.firstinverse};
+  for(int k = 0; k < 4; k++)
+    for(int row = 0; row < 3; row++)
+      for(int col = 0; col < 3; col++)
+        out[k][row][col] = mats[k][row][col];
+}
+
+struct LabMatrices : SpaceMatrices{
+  LabMatrices(){
+    double rgbToLms[3][3], lmsToRgb[3][3];
+    for(int row = 0; row < 3; row++)
+      for(int col = 0; col < 3; col++){
+        rgbToLms[row][col] = RGBTOLMS[row][col];
+        lmsToRgb[row][col] = LMSTORGB[row][col];
+      }
+    double tolab1[3][3] = {{1, 1, 1}, {1, 1, -2}, {1, -1, 0}};
+    double tolab2[3][3] = {{1 / sqrt(3), 0, 0}, {0, 1 / sqrt(6), 0}, {0, 0, 1 / sqrt(2)}};
+    double tolms1[3][3] = {{sqrt(3) / 3, 0, 0}, {0, sqrt(6) / 6, 0}, {0, 0, sqrt(2) / 2}};
+    double tolms2[3][3] = {{1, 1, 1}, {1, 1, -1}, {1, -2, 0}};
+
+    Matrix3D tolab = Matrix3D(tolab2) * Matrix3D(tolab1);
+    Matrix3D tolms = Matrix3D(tolms2) * Matrix3D(tolms1);
+    Matrix3D torgb(lmsToRgb);
+    spacematrices(Matrix3D(rgbToLms), tolab, *this, &tolms, &torgb);
+  }
+};
+
+const SpaceMatrices &labmatrices(){
+  static const LabMatrices m;
+  return m;
+}
+
+struct YCbCrMatrices : SpaceMatrices{
+  YCbCrMatrices(){
+    double toycc[3][3] = {{0.299, 0.587, 0.114},
+                          {-0.168736, -0.331264, 0.5},
+                          {0.5, -0.418688, -0.081312}};
+    double identity[3][3] = {{1, 0, 0}, {0, 1, 0}, {0, 0, 1}};
+    spacematrices(Matrix3D(toycc), Matrix3D(identity), *this);
+  }
+};
+
+const SpaceMatrices &ycbcrmatrices(){
+  static const YCbCrMatrices m;
+  return m;
+}
+
+struct CielabMatrices : SpaceMatrices{
+  CielabMatrices(){
+    // linear sRGB to XYZ, each row divided by its sum, the D65 white
+    double toxyz[3][3] = {{0.4124564, 0.3575761, 0.1804375},
+                          {0.2126729, 0.7151522, 0.0721750},
+                          {0.0193339, 0.1191920, 0.9503041}};
+    for(int row = 0; row < 3; row++){
+      double white = toxyz[row][0] + toxyz[row][1] + toxyz[row][2];
+      for(int col = 0; col < 3; col++)
+        toxyz[row][col] /= white;
+    }
+    double tolab[3][3] = {{0, 116, 0}, {500, -500, 0}, {0, 200, -200}};
+    spacematrices(Matrix3D(toxyz), Matrix3D(tolab), *this);
+  }
+};
+
+const SpaceMatrices &cielabmatrices(){
+  static const CielabMatrices m;
+  return m;
+}
+
+struct OklabMatrices : SpaceMatrices{
+  OklabMatrices(){
+    double tolms[3][3] = {{0.4122214708, 0.5363325363, 0.0514459929},
+                          {0.2119034982, 0.6806995451, 0.1073969566},
+                          {0.0883024619, 0.2817188376, 0.6299787005}};
+    double tolab[3][3] = {{0.2104542553, 0.7936177850, -0.0040720468},
+                          {1.9779984951, -2.4285922050, 0.4505937099},
+                          {0.0259040371, 0.7827717662, -0.8086757660}};
+    spacematrices(Matrix3D(tolms), Matrix3D(tolab), *this);
+  }
+};
+
+const SpaceMatrices &oklabmatrices(){
+  static const OklabMatrices m;
+  return m;
+}
+
+struct SrgbDecode{
+  float linear[256];
+
+  SrgbDecode(){
+    for(int v = 0; v < 256; v++){
+      double c = v / 255.0;
+      linear[v] = c <= 0.04045 ? c / 12.92 : pow((c + 0.055) / 1.055, 2.4);
+    }
+  }
+};
+
+const float *srgbdecodetable(){
+  static const SrgbDecode table;
+  return table.linear;
+}
@@ -0,0 +1,237 @@
+/*
+*   Color spaces for the single-precision kernels
+*
+*   The transfer matches the mean and standard deviation of each channel in
+*   some color space: lαβ for the reference and the kernels before these,
+*   and here also CIELAB, YCbCr and Oklab. A space is a policy with
+*
+*     void forward(const Pixel *pixels, int n, float *planes) const;
+*     void inverse(float *planes, int n) const;
+*
+*   forward converts n <= COLORBLOCK pixels to three planes of n values, one
+*   per channel of the space, and inverse converts such planes back to
+*   gamma encoded r, g and b planes in [0, 1], in place. Both are inline, so
+*   the kernel stages of transfer.cpp, which handle the statistics, palettes
+*   and the move between them, are compiled for each space with the
+*   conversion inlined into them. LabStats then hold the statistics of the
+*   space's three channels, and a statistics file, which names its kernel,
+*   can only be used with kernels of the same space.
+*
+*   YCbCr (BT.601, full range) is a matrix on the encoded values: no
+*   transcendental math at all, so it is the cheapest space, for thumbnails
+*   and previews. CIELAB (D65) and Oklab work in linear light: each 8-bit
+*   value is decoded from a table, and the cube roots and the sRGB encode
+*   take the Math policy's log10 and exp10 (transfer.cpp) over whole planes.
+*/
+
+#ifndef COLORSPACE_H
+#define COLORSPACE_H
+
+#include "transfer.h"
+
+#include <algorithm>
+
+const int COLORBLOCK = 256;   // most pixels a space converts at a time
+
+//
+// The float matrices of a space: first and second take RGB to the space,
+// and secondinverse and firstinverse take it back. The lαβ ones are those
+// of Reinhard et al., whose LMS to RGB matrix is the published one rather
+// than the exact inverse. Each is made once, on first use.
+//
+struct SpaceMatrices{
+  float first[3][3], second[3][3];
+  float secondinverse[3][3], firstinverse[3][3];
+};
+
+const SpaceMatrices &labmatrices();
+const SpaceMatrices &ycbcrmatrices();
+const SpaceMatrices &cielabmatrices();   // first includes the division by the white point
+const SpaceMatrices &oklabmatrices();
+
+// The linear light value of each 8-bit sRGB value
+const float *srgbdecodetable();
+
+/*
+   Multiply each of the n pixels held in three planes by m, in place.
+*/
+inline void planematrix(const float m[3][3], float *planes, int n){
+  for(int i = 0; i < n; i++){
+    float x = planes[i], y = planes[n + i], z = planes[2 * n + i];
+    for(int row = 0; row < 3; row++)
+      planes[row * n + i] = m[row][0] * x + m[row][1] * y + m[row][2] * z;
+  }
+}
+
+/*
+   Cube roots of n positive values in place, as 10^(log10(x) / 3).
+*/
+template<class Math>
+inline void cuberoots(float *values, int n){
+  Math::log10(values, values, n);
+  for(int i = 0; i < n; i++)
+    values[i] *= 1.0f / 3;
+  Math::exp10(values, values, n);
+}
+
+/*
+   Decode n pixels into linear light r, g and b planes.
+*/
+inline void linearplanes(const Pixel *pixels, int n, float *planes){
+  const float *decode = srgbdecodetable();
+  for(int i = 0; i < n; i++){
+    planes[i] = decode[pixels[i].r];
+    planes[n + i] = decode[pixels[i].g];
+    planes[2 * n + i] = decode[pixels[i].b];
+  }
+}
+
+/*
+   The sRGB encode of n linear light values in place. Negative values stay
+   on the linear segment.
+*/
+template<class Math>
+inline void srgbencode(float *values, int n){
+  const float knee = 0.0031308f;
+  float power[3 * COLORBLOCK];
+  for(int i = 0; i < n; i++)
+    power[i] = std::max(values[i], knee);
+  Math::log10(power, power, n);
+  for(int i = 0; i < n; i++)
+    power[i] *= 1 / 2.4f;
+  Math::exp10(power, power, n);
+  for(int i = 0; i < n; i++)
+    values[i] = values[i] <= knee ? 12.92f * values[i] : 1.055f * power[i] - 0.055f;
+}
+
+//
+// lαβ of Reinhard et al.: RGB clamped at 1/255 like the reference, to LMS,
+// its log10, then the lαβ matrix
+//
+template<class Math>
+class LabSpace{
+private:
+  const SpaceMatrices &m;
+
+public:
+  LabSpace(): m(labmatrices()) {}
+
+  void forward(const Pixel *pixels, int n, float *planes) const{
+    for(int i = 0; i < n; i++){
+      float rgb[3] = {std::max(float(pixels[i].r), 1.0f) / 255,
+                      std::max(float(pixels[i].g), 1.0f) / 255,
+                      std::max(float(pixels[i].b), 1.0f) / 255};
+      for(int row = 0; row < 3; row++)
+        planes[row * n + i] = m.first[row][0] * rgb[0] + m.first[row][1] * rgb[1] +
+                              m.first[row][2] * rgb[2];
+    }
+    Math::log10(planes, planes, 3 * n);
+    planematrix(m.second, planes, n);
+  }
+
+  void inverse(float *planes, int n) const{
+    planematrix(m.secondinverse, planes, n);
+    Math::exp10(planes, planes, 3 * n);
+    planematrix(m.firstinverse, planes, n);
+  }
+};
+
+//
+// YCbCr: one matrix each way on the gamma encoded values
+//
+class YCbCrSpace{
+private:
+  const SpaceMatrices &m;
+
+public:
+  YCbCrSpace(): m(ycbcrmatrices()) {}
+
+  void forward(const Pixel *pixels, int n, float *planes) const{
+    for(int i = 0; i < n; i++){
+      float rgb[3] = {float(pixels[i].r) / 255, float(pixels[i].g) / 255,
+                      float(pixels[i].b) / 255};
+      for(int row = 0; row < 3; row++)
+        planes[row * n + i] = m.first[row][0] * rgb[0] + m.first[row][1] * rgb[1] +
+                              m.first[row][2] * rgb[2];
+    }
+  }
+
+  void inverse(float *planes, int n) const { planematrix(m.firstinverse, planes, n); }
+};
+
+//
+// CIELAB: linear light to XYZ relative to the D65 white, the CIE cube root
+// function f, then L*, a* and b* as a matrix on f(X), f(Y) and f(Z), less
+// 16 for L*
+//
+template<class Math>
+class CielabSpace{
+private:
+  const SpaceMatrices &m;
+  static const float EPSILON;   // (6/29)^3, where f turns linear
+
+public:
+  CielabSpace(): m(cielabmatrices()) {}
+
+  void forward(const Pixel *pixels, int n, float *planes) const{
+    float roots[3 * COLORBLOCK];
+    linearplanes(pixels, n, planes);
+    planematrix(m.first, planes, n);
+    for(int i = 0; i < 3 * n; i++)
+      roots[i] = std::max(planes[i], EPSILON);
+    cuberoots<Math>(roots, 3 * n);
+    for(int i = 0; i < 3 * n; i++)
+      planes[i] = planes[i] > EPSILON ? roots[i] : planes[i] * (841.0f / 108) + 4.0f / 29;
+    planematrix(m.second, planes, n);
+    for(int i = 0; i < n; i++)
+      planes[i] -= 16;
+  }
+
+  void inverse(float *planes, int n) const{
+    for(int i = 0; i < n; i++)
+      planes[i] += 16;
+    planematrix(m.secondinverse, planes, n);
+    for(int i = 0; i < 3 * n; i++){
+      float f = planes[i];
+      planes[i] = f > 6.0f / 29 ? f * f * f : (f - 4.0f / 29) * (108.0f / 841);
+    }
+    planematrix(m.firstinverse, planes, n);
+    srgbencode<Math>(planes, 3 * n);
+  }
+};
+
+template<class Math>
+const float CielabSpace<Math>::EPSILON = 216.0f / 24389;
+
+//
+// Oklab of Ottosson in linear light: linear RGB to LMS, cube roots, then
+// the Oklab matrix. Black is taken as a tiny positive LMS so that its log
+// exists.
+//
+template<class Math>
+class OklabSpace{
+private:
+  const SpaceMatrices &m;
+
+public:
+  OklabSpace(): m(oklabmatrices()) {}
+
+  void forward(const Pixel *pixels, int n, float *planes) const{
+    linearplanes(pixels, n, planes);
+    planematrix(m.first, planes, n);
+    for(int i = 0; i < 3 * n; i++)
+      planes[i] = std::max(planes[i], 1e-30f);
+    cuberoots<Math>(planes, 3 * n);
+    planematrix(m.second, planes, n);
+  }
+
+  void inverse(float *planes, int n) const{
+    planematrix(m.secondinverse, planes, n);
+    for(int i = 0; i < 3 * n; i++)
+      planes[i] = planes[i] * planes[i] * planes[i];
+    planematrix(m.firstinverse, planes, n);
+    srgbencode<Math>(planes, 3 * n);
+  }
+};
+
+#endif
@@ -1,823 +1,1143 @@
-/*
- * Program to transfer colors from one image to another
- * 
- * Command line parameters are as follows:
- *
- * colortransfer source.png destination.png [outfile.png]
- *
- * Author: Drake Hunter, 12/2/2019
- * Credits: Ioannis Karamouzas, 10/20/19
- */
-
-#include "matrix.h"
-
-#include <cstdio>
-#include <cstdlib>
-#include <iostream>
-#include <string>
-#include <OpenImageIO/imageio.h>
-#include <GL/glut.h>
-
-using namespace std;
-OIIO_NAMESPACE_USING
-
-
-struct Pixel { // defines a pixel structure
-  unsigned char r,g,b,a;
-}; 
-
-using std::string;
-
-//
-// Global variables and constants
-//
-const int DEFAULTWIDTH = 600; // default window dimensions if no image
-const int DEFAULTHEIGHT = 600;
-
-int WinWidth, WinHeight;  // window width and height
-int DestImWidth, DestImHeight;    // dest image width and height
-int SourceImWidth, SourceImHeight;    // source image width and height
-int H2, W2;
-int ImChannels;           // number of channels per image pixel
-int SourceImChannels;
-
-int VpWidth, VpHeight;    // viewport width and height
-int Xoffset, Yoffset;     // viewport offset from lower left corner of window
-
-Pixel **source = NULL;  // the image pixmap used for reading in
-Pixel **scaledsource = NULL;
-Pixel **dest = NULL;
-Pixel **display = NULL; // the image pixmap used for display
-Pixel **out = NULL; // the image pixmap used for output
-
-int pixformat;      // the pixel format used to correctly  draw the image
-
-void destroy(){
-  if(dest) {
-      delete dest[0];
-    delete dest;  
-  }
-}
-
-void destroysource(){
-  if(source) {
-      delete source[0];
-    delete source;  
-  }
-}
-
-//
-//  Routine to read an image file and store in a dest
-//  returns the size of the image in pixels if correctly read, or 0 if failure
-//
-int readimage(string infilename){
-  // Create the oiio file handler for the image, and open the file for reading the image.
-  // Once open, the file spec will indicate the width, height and number of channels.
-  ImageInput *infile = ImageInput::open(infilename);
-  if(!infile){
-    cerr << "Could not input image file " << infilename << ", error = " << geterror() << endl;
-    return 0;
-  }
-
-  // Record image width, height and number of channels in global variables
-  DestImWidth = infile->spec().width;
-  DestImHeight = infile->spec().height;
-  ImChannels = infile->spec().nchannels;
-
- 
-  // allocate temporary structure to read the image 
-  unsigned char tmp_pixels[DestImWidth * DestImHeight * ImChannels];
-
-  // read the image into the tmp_pixels from the input file, flipping it upside down using negative y-stride,
-  // since OpenGL pixmaps have the bottom scanline first, and 
-  // oiio expects the top scanline first in the image file.
-  int scanlinesize = DestImWidth * ImChannels * sizeof(unsigned char);
-  if(!infile->read_image(TypeDesc::UINT8, &tmp_pixels[0] + (DestImHeight - 1) * scanlinesize, AutoStride, -scanlinesize)){
-    cerr << "Could not read image from " << infilename << ", error = " << geterror() << endl;
-    ImageInput::destroy(infile);
-    return 0;
-  }
- 
- // get rid of the old OpenGL dest and make a new one of the new size
-  destroy();
-  
- // allocate space for the dest (contiguous approach)
-  dest = new Pixel*[DestImHeight];
-  if(dest != NULL)
-  dest[0] = new Pixel[DestImWidth * DestImHeight];
-  for(int i = 1; i < DestImHeight; i++)
-  dest[i] = dest[i - 1] + DestImWidth;
- 
- //  assign the read pixels to the dest
- int index;
-  for(int row = 0; row < DestImHeight; ++row) {
-    for(int col = 0; col < DestImWidth; ++col) {
-    index = (row*DestImWidth+col)*ImChannels;
-    
-    if (ImChannels==1){ 
-      dest[row][col].r = tmp_pixels[index];
-      dest[row][col].g = tmp_pixels[index];
-      dest[row][col].b = tmp_pixels[index];
-      dest[row][col].a = 255;
-    }
-    else{
-      dest[row][col].r = tmp_pixels[index];
-      dest[row][col].g = tmp_pixels[index+1];
-      dest[row][col].b = tmp_pixels[index+2];     
-      if (ImChannels <4) // no alpha value is present so set it to 255
-        dest[row][col].a = 255; 
-      else // read the alpha value
-        dest[row][col].a = tmp_pixels[index+3];     
-    }
-    }
-  }
- 
-  // close the image file after reading, and free up space for the oiio file handler
-  infile->close();
-  ImageInput::destroy(infile);
-  
-  // set the pixel format to GL_RGBA and fix the # channels to 4  
-  pixformat = GL_RGBA;  
-  ImChannels = 4;
-
-  // return image size in pixels
-  return DestImWidth * DestImHeight;
-}
-
-int readsourceimage(string infilename){
-  // Create the oiio file handler for the image, and open the file for reading the image.
-  // Once open, the file spec will indicate the width, height and number of channels.
-  ImageInput *infile = ImageInput::open(infilename);
-  if(!infile){
-    cerr << "Could not input image file " << infilename << ", error = " << geterror() << endl;
-    return 0;
-  }
-
-  // Record image width, height and number of channels in global variables
-  SourceImWidth = infile->spec().width;
-  SourceImHeight = infile->spec().height;
-  SourceImChannels = infile->spec().nchannels;
-
- 
-  // allocate temporary structure to read the image 
-  unsigned char tmp_pixels[SourceImWidth * SourceImHeight * SourceImChannels];
-
-  // read the image into the tmp_pixels from the input file, flipping it upside down using negative y-stride,
-  // since OpenGL pixmaps have the bottom scanline first, and 
-  // oiio expects the top scanline first in the image file.
-  int scanlinesize = SourceImWidth * SourceImChannels * sizeof(unsigned char);
-  if(!infile->read_image(TypeDesc::UINT8, &tmp_pixels[0] + (SourceImHeight - 1) * scanlinesize, AutoStride, -scanlinesize)){
-    cerr << "Could not read image from " << infilename << ", error = " << geterror() << endl;
-    ImageInput::destroy(infile);
-    return 0;
-  }
- 
- // get rid of the old OpenGL source and make a new one of the new size
-  destroysource();
-  
- // allocate space for the dest (contiguous approach)
-  source = new Pixel*[SourceImHeight];
-  if(source != NULL)
-  source[0] = new Pixel[SourceImWidth * SourceImHeight];
-  for(int i = 1; i < SourceImHeight; i++)
-  source[i] = source[i - 1] + SourceImWidth;
- 
- //  assign the read pixels to the dest
- int index;
-  for(int row = 0; row < SourceImHeight; ++row) {
-    for(int col = 0; col < SourceImWidth; ++col) {
-      index = (row*SourceImWidth+col)*SourceImChannels;
-      if (SourceImChannels==1){ 
-        source[row][col].r = tmp_pixels[index];
-        source[row][col].g = tmp_pixels[index];
-        source[row][col].b = tmp_pixels[index];
-        source[row][col].a = 255;
-      }
-      else{
-        source[row][col].r = tmp_pixels[index];
-        source[row][col].g = tmp_pixels[index+1];
-        source[row][col].b = tmp_pixels[index+2];     
-        if (SourceImChannels <4) // no alpha value is present so set it to 255
-          source[row][col].a = 255; 
-        else // read the alpha value
-          source[row][col].a = tmp_pixels[index+3];     
-      }
-    }
-  }
- 
-  // close the image file after reading, and free up space for the oiio file handler
-  infile->close();
-  ImageInput::destroy(infile);
-  
-  // set the pixel format to GL_RGBA and fix the # channels to 4  
-  pixformat = GL_RGBA;  
-  SourceImChannels = 4;
-
-  // return image size in pixels
-  return SourceImWidth * SourceImHeight;
-}
-
-//
-// Routine to write the current framebuffer to an image file
-//
-void writeimage(string outfilename){
-  // make a dest that is the size of the window and grab OpenGL framebuffer into it
-   unsigned char local_pixmap[WinWidth * WinHeight * ImChannels];
-   glReadPixels(0, 0, WinWidth, WinHeight, pixformat, GL_UNSIGNED_BYTE, local_pixmap);
-  
-  // create the oiio file handler for the image
-  ImageOutput *outfile = ImageOutput::create(outfilename);
-  if(!outfile){
-    cerr << "Could not create output image for " << outfilename << ", error = " << geterror() << endl;
-    return;
-  }
-  
-  // Open a file for writing the image. The file header will indicate an image of
-  // width WinWidth, height WinHeight, and ImChannels channels per pixel.
-  // All channels will be of type unsigned char
-  ImageSpec spec(WinWidth, WinHeight, ImChannels, TypeDesc::UINT8);
-  if(!outfile->open(outfilename, spec)){
-    cerr << "Could not open " << outfilename << ", error = " << geterror() << endl;
-    ImageOutput::destroy(outfile);
-    return;
-  }
-  
-  // Write the image to the file. All channel values in the dest are taken to be
-  // unsigned chars. While writing, flip the image upside down by using negative y stride, 
-  // since OpenGL pixmaps have the bottom scanline first, and oiio writes the top scanline first in the image file.
-  int scanlinesize = WinWidth * ImChannels * sizeof(unsigned char);
-  if(!outfile->write_image(TypeDesc::UINT8, local_pixmap + (WinHeight - 1) * scanlinesize, AutoStride, -scanlinesize)){
-    cerr << "Could not write image to " << outfilename << ", error = " << geterror() << endl;
-    ImageOutput::destroy(outfile);
-    return;
-  }
-  
-  // close the image file after the image is written and free up space for the
-  // ooio file handler
-  outfile->close();
-  ImageOutput::destroy(outfile);
-}
-
-
-//Write the image from the commandline argument
-void writefromcmdline(string outfilename) {
-
-  //Vertically flip
-  for (int col = 0; col < DestImWidth; col++) {
-        for (int row = 0; row < DestImHeight/2; row++) {
-          swap(out[row][col], out[DestImHeight-1-row][col]);
-      }
-    }
-
-  // create the oiio file handler for the image
-  ImageOutput *outfile = ImageOutput::create(outfilename);
-  if(!outfile){
-    cerr << "Could not create output image for " << outfilename << ", error = " << geterror() << endl;
-    return;
-  }
-  
-  // Open a file for writing the image. The file header will indicate an image of
-  // width WinWidth, height WinHeight, and ImChannels channels per pixel.
-  // All channels will be of type unsigned char
-  ImageSpec spec(WinWidth, WinHeight, ImChannels, TypeDesc::UINT8);
-  if(!outfile->open(outfilename, spec)){
-    cerr << "Could not open " << outfilename << ", error = " << geterror() << endl;
-    ImageOutput::destroy(outfile);
-    return;
-  }
-  
-  // Write the image to the file. All channel values in the pixmap are taken to be
-  // unsigned chars. While writing, flip the image upside down by using negative y stride, 
-  // since OpenGL pixmaps have the bottom scanline first, and oiio writes the top scanline first in the image file.
-  if(!outfile->write_image(TypeDesc::UINT8, out[0])){
-    cerr << "Could not write image to " << outfilename << ", error = " << geterror() << endl;
-    ImageOutput::destroy(outfile);
-    return;
-  }
-
-  // close the image file after the image is written and free up space for the
-  // ooio file handler
-  outfile->close();
-  ImageOutput::destroy(outfile);
-
-}
-
-//
-// Routine to display a dest in the current window
-//
-void displayimage(){
-  // if the window is smaller than the image, scale it down, otherwise do not scale
-  if(WinWidth < DestImWidth  || WinHeight < DestImHeight)
-    glPixelZoom(float(VpWidth) / DestImWidth, float(VpHeight) / DestImHeight);
-  else
-    glPixelZoom(1.0, 1.0);
-  
-  // display starting at the lower lefthand corner of the viewport
-  glRasterPos2i(0, 0);
-
-  glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
-  glDrawPixels(DestImWidth, DestImHeight, pixformat, GL_UNSIGNED_BYTE, display[0]);
-}
-
-//
-//   Display Callback Routine: clear the screen and draw the current image
-//
-void handleDisplay(){
-  
-  // specify window clear (background) color to be opaque black
-  glClearColor(0, 0, 0, 1);
-  // clear window to background color
-  glClear(GL_COLOR_BUFFER_BIT);  
-  
-  // only draw the image if it is of a valid size
-  if(DestImWidth > 0 && DestImHeight > 0)
-    displayimage();
-  
-  // flush the OpenGL pipeline to the viewport
-  glFlush();
-}
-
-//
-//  Keyboard Callback Routine: 
-//  'w' or 'W' to write the image to file
-//  'q' or ESC - quit
-//
-void handleKey(unsigned char key, int x, int y){
-  string outfilename;
-  
-  switch(key){
-    case 'w':   // 'w' - write the image to a file
-    case 'W':
-      cout << "Output image filename? ";  // prompt user for output filename
-      cin >> outfilename;
-      writeimage(outfilename);
-      break;
-
-    case 'q':   // q or ESC - quit
-    case 'Q':
-    case 27:
-      destroy();
-      destroysource();
-      exit(0);
-      
-    default:    // not a valid key -- just ignore it
-      return;
-  }
-}
-
-//
-//  Reshape Callback Routine: If the window is too small to fit the image,
-//  make a viewport of the maximum size that maintains the image proportions.
-//  Otherwise, size the viewport to match the image size. In either case, the
-//  viewport is centered in the window.
-//
-void handleReshape(int w, int h){
-  float imageaspect = (float)DestImWidth / (float)DestImHeight; // aspect ratio of image
-  float newaspect = (float)w / (float)h; // new aspect ratio of window
-  
-  // record the new window size in global variables for easy access
-  WinWidth = w;
-  WinHeight = h;
-  
-  // if the image fits in the window, viewport is the same size as the image
-  if(w >= DestImWidth && h >= DestImHeight){
-    Xoffset = (w - DestImWidth) / 2;
-    Yoffset = (h - DestImHeight) / 2;
-    VpWidth = DestImWidth;
-    VpHeight = DestImHeight;
-  }
-  // if the window is wider than the image, use the full window height
-  // and size the width to match the image aspect ratio
-  else if(newaspect > imageaspect){
-    VpHeight = h;
-    VpWidth = int(imageaspect * VpHeight);
-    Xoffset = int((w - VpWidth) / 2);
-    Yoffset = 0;
-  }
-  // if the window is narrower than the image, use the full window width
-  // and size the height to match the image aspect ratio
-  else{
-    VpWidth = w;
-    VpHeight = int(VpWidth / imageaspect);
-    Yoffset = int((h - VpHeight) / 2);
-    Xoffset = 0;
-  }
-  
-  // center the viewport in the window
-  glViewport(Xoffset, Yoffset, VpWidth, VpHeight);
-  
-  // viewport coordinates are simply pixel coordinates
-  glMatrixMode(GL_PROJECTION);
-  glLoadIdentity();
-  gluOrtho2D(0, VpWidth, 0, VpHeight);
-  glMatrixMode(GL_MODELVIEW);
-}
-
-void calculate() {
-  double rgbToLms[3][3];
-  rgbToLms[0][0] = 0.3811;
-  rgbToLms[0][1] = 0.5783;
-  rgbToLms[0][2] = 0.0402;
-  rgbToLms[1][0] = 0.1967;
-  rgbToLms[1][1] = 0.7244;
-  rgbToLms[1][2] = 0.0782;
-  rgbToLms[2][0] = 0.0241;
-  rgbToLms[2][1] = 0.1288;
-  rgbToLms[2][2] = 0.8444;
-
-  Matrix3D rgbToLmsMatrix(rgbToLms);
-
-  double lmsToLab1[3][3];
-  lmsToLab1[0][0] = lmsToLab1[0][1] = lmsToLab1[0][2] = 1;
-  lmsToLab1[1][0] = lmsToLab1[1][1] = 1;
-  lmsToLab1[1][2] = -2;
-  lmsToLab1[2][0] = 1;
-  lmsToLab1[2][1] = -1;
-  lmsToLab1[2][2] = 0;
-
-  double lmsToLab2[3][3];
-  lmsToLab2[0][0] = 1 / sqrt(3);
-  lmsToLab2[0][1] = lmsToLab2[0][2] = lmsToLab2[1][0] = 0;
-  lmsToLab2[1][1] = 1 / sqrt(6);
-  lmsToLab2[1][2] = lmsToLab2[2][0] = lmsToLab2[2][1] = 0;
-  lmsToLab2[2][2] = 1 / sqrt(2);
-
-  Matrix3D lmsToLab1Matrix(lmsToLab1);
-  Matrix3D lmsToLab2Matrix(lmsToLab2);
-
-  Vector3D *sourceLabArray = new Vector3D[DestImHeight * DestImWidth];
-  Vector3D *destLabArray = new Vector3D[DestImHeight * DestImWidth];
-
-  //Convert RGB to LMS
-  int index = 0;
-  for(int row = 0; row < DestImHeight; row++) {
-      for(int col = 0; col < DestImWidth; col++) {
-        Vector3D sourceRGB(max(double(scaledsource[row][col].r)/255, 1.0/255), 
-          max(double(scaledsource[row][col].g)/255, 1.0/255), 
-          max(double(scaledsource[row][col].b)/255, 1.0/255));
-        Vector3D sourceLMS = rgbToLmsMatrix * sourceRGB;
-        //convert to log scale
-        sourceLMS.x = log10(sourceLMS.x);
-        sourceLMS.y = log10(sourceLMS.y);
-        sourceLMS.z = log10(sourceLMS.z);
-
-        Vector3D destRGB(max(double(dest[row][col].r)/255, 1.0/255), 
-          max(double(dest[row][col].g)/255, 1.0/255), 
-          max(double(dest[row][col].b)/255, 1.0/255));
-        Vector3D destLMS = rgbToLmsMatrix * destRGB;
-
-        //convert to log scale
-        destLMS.x = log10(destLMS.x);
-        destLMS.y = log10(destLMS.y);
-        destLMS.z = log10(destLMS.z);
-
-        //Convert from LMS to lαβ 
-        Matrix3D sourceLmsToLabM = lmsToLab2Matrix * lmsToLab1Matrix;
-        Vector3D sourceLab = sourceLmsToLabM * sourceLMS;
-
-        Matrix3D destLmsToLabM = lmsToLab2Matrix * lmsToLab1Matrix;
-        Vector3D destLab = destLmsToLabM * destLMS;
-
-        sourceLabArray[index] = sourceLab;
-        destLabArray[index] = destLab;
-        index++;
-      }
-  }
-
-  //Calculate mean values for l, α, and β source and destination images
-  double sourceSumL = 0, sourceSumA = 0, sourceSumB = 0;
-  double destSumL = 0, destSumA = 0, destSumB = 0;
-
-  for(int i = 0; i < DestImHeight * DestImWidth; i++) {
-    sourceSumL += sourceLabArray[i].x;
-    sourceSumA += sourceLabArray[i].y;
-    sourceSumB += sourceLabArray[i].z;
-
-    destSumL += destLabArray[i].x;
-    destSumA += destLabArray[i].y;
-    destSumB += destLabArray[i].z;
-  }
-
-  double total = double(DestImHeight) * double(DestImWidth);
-
-  double sourceMeanL = sourceSumL / total;
-  double sourceMeanA = sourceSumA / total;
-  double sourceMeanB = sourceSumB / total;
-
-  double destMeanL = destSumL / total;
-  double destMeanA = destSumA / total;
-  double destMeanB = destSumB / total;
-
-  //Calculate standard deviation for l, α, and β source and destination images
-  double sourceVarianceL = 0, sourceVarianceA = 0, sourceVarianceB = 0;
-  double destVarianceL = 0, destVarianceA = 0, destVarianceB = 0;
-
-  for(int i = 0; i < DestImHeight * DestImWidth; i++) {
-    sourceVarianceL += pow(sourceLabArray[i].x - sourceMeanL, 2);
-    sourceVarianceA += pow(sourceLabArray[i].y - sourceMeanA, 2);
-    sourceVarianceB += pow(sourceLabArray[i].z - sourceMeanB, 2);
-
-    destVarianceL += pow(destLabArray[i].x - destMeanL, 2);
-    destVarianceA += pow(destLabArray[i].y - destMeanA, 2);
-    destVarianceB += pow(destLabArray[i].z - destMeanB, 2);
-  }
-
-  double sourceStdL = sqrt(sourceVarianceL / total);
-  double sourceStdA = sqrt(sourceVarianceA / total);
-  double sourceStdB = sqrt(sourceVarianceB / total);
-
-  double destStdL = sqrt(destVarianceL / total);
-  double destStdA = sqrt(destVarianceA / total);
-  double destStdB = sqrt(destVarianceB / total);
-
-  //Calculate ratio standard deviations
-  double ratioStdL = sourceStdL / destStdL;
-  double ratioStdA = sourceStdA / destStdA;
-  double ratioStdB = sourceStdB / destStdB;
-
-  //Calculate new data for destination lαβ
-  for(int i = 0; i < DestImHeight * DestImWidth; i++) {
-    destLabArray[i].x -= destMeanL;
-    destLabArray[i].x *= ratioStdL;
-    destLabArray[i].x += sourceMeanL;
-
-    destLabArray[i].y -= destMeanA;
-    destLabArray[i].y *= ratioStdA;
-    destLabArray[i].y += sourceMeanA;
-
-    destLabArray[i].z -= destMeanB;
-    destLabArray[i].z *= ratioStdB;
-    destLabArray[i].z += sourceMeanB;
-  }
-
-  //Convert lαβ to LMS
-  double labToLms1[3][3];
-  labToLms1[0][0] = sqrt(3) / 3;
-  labToLms1[0][1] = labToLms1[0][2] = labToLms1[1][0] = 0;
-  labToLms1[1][1] = sqrt(6) / 6;
-  labToLms1[1][2] = labToLms1[2][0] = labToLms1[2][1] = 0;
-  labToLms1[2][2] = sqrt(2) / 2;
-
-  double labToLms2[3][3];
-  labToLms2[0][0] = labToLms2[0][1] = labToLms2[0][2] = 1;
-  labToLms2[1][0] = labToLms2[1][1] = 1;
-  labToLms2[1][2] = -1;
-  labToLms2[2][0] = 1;
-  labToLms2[2][1] = -2;
-  labToLms2[2][2] = 0;
-
-  Matrix3D labToLms1Matrix(labToLms1);
-  Matrix3D labToLms2Matrix(labToLms2);
-
-  //Convert from LMS to RGB
-  double lmsToRgb[3][3];
-  lmsToRgb[0][0] = 4.4679;
-  lmsToRgb[0][1] = -3.5873;
-  lmsToRgb[0][2] = 0.1193;
-  lmsToRgb[1][0] = -1.2186;
-  lmsToRgb[1][1] = 2.3809;
-  lmsToRgb[1][2] = -0.1624;
-  lmsToRgb[2][0] = 0.0497;
-  lmsToRgb[2][1] = -0.2439;
-  lmsToRgb[2][2] = 1.2045;
-
-  Matrix3D lmsToRgbMatrix(lmsToRgb);
-
-  Vector3D *destRGBArray = new Vector3D[DestImHeight * DestImWidth];
-
-  for(int i = 0; i < DestImHeight * DestImWidth; i++) {
-    Matrix3D labToLmsM = labToLms2Matrix * labToLms1Matrix;
-    destLabArray[i] = labToLmsM * destLabArray[i];
-
-    //Convert back to linear space
-    destLabArray[i].x = pow(10, destLabArray[i].x);
-    destLabArray[i].y = pow(10, destLabArray[i].y);
-    destLabArray[i].z = pow(10, destLabArray[i].z);
-
-    //Convert LMS back to RGB
-    destRGBArray[i] = lmsToRgbMatrix * destLabArray[i];
-  }
-
-  display = new Pixel*[DestImHeight];
-  if(display != NULL)
-   display[0] = new Pixel[DestImWidth * DestImHeight];
-  for(int i = 1; i < DestImHeight; i++)
-   display[i] = display[i - 1] + DestImWidth;
-
-  index = 0;
-  for(int row = 0; row < DestImHeight; row++) {
-      for(int col = 0; col < DestImWidth; col++) {
-        display[row][col].r = min(abs(destRGBArray[index].x * 255), float(255));
-        display[row][col].g = min(abs(destRGBArray[index].y * 255), float(255));
-        display[row][col].b = min(abs(destRGBArray[index].z * 255), float(255));
-
-        index++;
-      }
-  }
-
-}
-
-/*
-Multiply M by a scale matrix of scaleX and scaleY
-*/
-void Scale(Matrix3D &M, double scaleX, double scaleY) {
-  Matrix3D S; 
-  S[0][0] = scaleX;
-  S[1][1] = scaleY;
-
-  M = S * M;
-}
-
-/*
-   Main program to read an image file, then ask the user
-   for transform information, transform the image and display
-   it using the appropriate warp.  Optionally save the transformed
-   images in  files.
-*/
-int main(int argc, char *argv[]){
-
-  // set up the default window and empty dest if no image or image fails to load
-  WinWidth = DEFAULTWIDTH;
-  WinHeight = DEFAULTHEIGHT;
-  DestImWidth = 0;
-  DestImHeight = 0;
-  SourceImWidth = 0;
-  SourceImHeight = 0;
-
-  // initialize transformation matrix to identity
-  Matrix3D M;
-
-  if(argc == 3 || argc == 4) {
-    //Read in source image
-    readsourceimage(argv[1]);
-    //Read in other image
-    readimage(argv[2]);
-
-    if(SourceImWidth != DestImWidth || SourceImHeight != DestImHeight) {
-      //Scale source image to same size as destination
-      Scale(M, double(DestImWidth)/double(SourceImWidth), double(DestImHeight)/double(SourceImHeight));
-
-      // code to perform inverse mapping (4 steps)
-      // set each corner of the image
-      Vector3D corner1(0, 0, 1);
-      Vector3D corner2(SourceImWidth, 0, 1);
-      Vector3D corner3(0, SourceImHeight, 1);
-      Vector3D corner4(SourceImWidth, SourceImHeight, 1);
-
-      Vector3D v0 = M * corner1;
-      v0.x /= v0.z;
-      v0.y /= v0.z;
-     
-      Vector3D v1 = M * corner2;
-      v1.x /= v1.z;
-      v1.y /= v1.z;
-
-      Vector3D v2 = M * corner3;
-      v2.x /= v2.z;
-      v2.y /= v2.z;
-
-      Vector3D v3 = M * corner4;
-      v3.x /= v3.z;
-      v3.y /= v3.z;
-
-      //Find the top, bottom, left, and right points
-      double top = v0.y;
-      if(v1.y > top) {
-        top = v1.y;
-      }
-      if(v2.y > top) {
-        top = v2.y;
-      }
-      if(v3.y > top) {
-        top = v3.y;
-      }
-      double bottom = v0.y;
-      if(v1.y < bottom) {
-        bottom = v1.y;
-      }
-      if(v2.y < bottom) {
-        bottom = v2.y;
-      }
-      if(v3.y < bottom) {
-        bottom = v3.y;
-      }
-      double left = v0.x;
-      if(v1.x < left) {
-        left = v1.x;
-      }
-      if(v2.x < left) {
-        left = v2.x;
-      }
-      if(v3.x < left) {
-        left = v3.x;
-      }
-      double right = v0.x;
-      if(v1.x > right) {
-        right = v1.x;
-      }
-      if(v2.x > right) {
-        right = v2.x;
-      }
-      if(v3.x > right) {
-        right = v3.x;
-      }
-
-      //Build transform matrix
-      double coefs[3][3];
-      coefs[0][0] = coefs[1][1] = coefs[2][2] = 1.0;
-      coefs[2][0] = coefs[2][1] = coefs[0][1] = coefs[1][0] = 0.0;
-      coefs[1][2] = -bottom;
-      coefs[0][2] = -left;
-
-      Matrix3D tr(coefs);
-      
-      //Find new height and width
-      W2 = right - left;
-      H2 = top - bottom;
-
-      //Allocate memory for scaled image
-      scaledsource = new Pixel*[H2];
-      scaledsource[0] = new Pixel[H2*W2];
-      for(int i = 1; i < H2; i++)
-        scaledsource[i] = scaledsource[i - 1] + W2;
-
-      M = tr * M;
-      Matrix3D invM = M.inverse();
-
-      for(int y = 0; y < H2; y++) {
-        for(int x = 0; x < W2; x++) {
-          //map the pixel coordinates
-          Vector3D pixel_out(x, y, 1);
-          Vector3D pixel_in = invM * pixel_out;
-
-          //normalize the dest
-          int u = pixel_in.x / pixel_in.z;
-          int v = pixel_in.y / pixel_in.z;
-          if(u >= 0 && u < SourceImWidth && v >= 0 && v < SourceImHeight) {
-            scaledsource[y][x] = source[v][u];
-          }
-
-        }
-      }
-    } else {
-      
-      scaledsource = new Pixel*[DestImHeight];
-      scaledsource[0] = new Pixel[DestImHeight*DestImWidth];
-      for(int i = 1; i < DestImHeight; i++)
-        scaledsource[i] = scaledsource[i - 1] + DestImWidth;
-
-      for(int x = 0; x < DestImHeight; x++) {
-        for(int y = 0; y < DestImWidth; y++) {
-          scaledsource[x][y] = source[x][y];
-        }
-      }
-
-    }
-
-    //Perform calculations
-    calculate();
-
-    WinWidth = DestImWidth;
-    WinHeight = DestImHeight;
-
-    //Write the image to inputted file
-    if(argc == 4) {
-        //Allocate space for output pixmap
-      out = new Pixel*[DestImHeight];
-      if(out != NULL)
-      out[0] = new Pixel[DestImWidth * DestImHeight];
-      for(int i = 1; i < DestImHeight; i++)
-      out[i] = out[i - 1] + DestImWidth;
-
-      //Copy display to out pixmap
-      for (int row = 0; row < DestImHeight; row++) {
-        for (int col = 0; col < DestImWidth; col++) {
-          out[row][col] = display[row][col];
-        }
-      }
-
-      writefromcmdline(argv[3]);
-    }
-
-
-    //your code to display the warped image
-    // start up the glut utilities
-    glutInit(&argc, argv);
-
-    // create the graphics window, giving width, height, and title text
-    glutInitDisplayMode(GLUT_SINGLE | GLUT_RGBA);
-    glutInitWindowSize(WinWidth, WinHeight);
-    glutCreateWindow("Color Transfer");
-    
-    // set up the callback routines to be called when glutMainLoop() detects
-    // an event
-    glutDisplayFunc(handleDisplay); // display callback
-    glutKeyboardFunc(handleKey);    // keyboard key press callback
-    glutReshapeFunc(handleReshape); // window resize callback
-
-    // Enter GLUT's event loop
-    glutMainLoop();
-  }
-
-  return 0;
-}
+/*
+ * Program to transfer colors from one image to another
+ * 
+ * Command line parameters are as follows:
+ *
+ * colortransfer [-kernel name] [-alpha] [-reduce | -sourcemask mask.png]
+ *               [-destmask mask.png] [-histogram [-blend w]]
+ *               source.png destination.png [outfile.png]
+ * colortransfer [-kernel name] [-alpha] [-reduce] [-destmask mask.png] [-threads n]
+ *               [-histogram [-blend w]] -batch destination.png outdir source.png ...
+ * colortransfer [-kernel name] [-alpha] [-tilerows n] [-tiles first-last]
+ *               -partial image.png partial.stats
+ * colortransfer -merge image.stats partial.stats ...
+ * colortransfer [-kernel name] [-alpha] [-tilerows n] [-tiles first-last]
+ *               [-threads n] -applytiles source.stats destination.stats
+ *               destination.png outdir
+ * colortransfer -budget ms source.png destination.png outfile.png
+ * colortransfer -retune
+ *
+ * Any of these also takes [-poolcap MB] [-poolstats].
+ *
+ * The first run on a host times the kernels, thread counts and piece sizes
+ * of the transfer loops on synthetic images, which takes a few seconds, and
+ * writes the fastest to ~/.colortransfer-tuning (autotune.h); later runs
+ * read it. -retune tunes again, alone or before any transfer. The tuned kernel is used by single
+ * and batch transfers that give no -kernel, and the tuned thread count
+ * wherever -threads is not given
+ *
+ * -budget transfers within ms milliseconds, from reading the files to
+ * writing the result, as close to the full quality transfer as fits. The
+ * first budgeted run on a host also measures the cost and the loss of each
+ * kernel, JPEG source reduction and statistics scanline stride on
+ * synthetic images, keeping them in ~/.colortransfer-costs (budget.h). Of
+ * the combinations, or tiers, whose estimated time fits, the one with the
+ * least estimated loss is used, and printed with its estimated time and
+ * mean ΔE from the full quality transfer. The source is not scaled to the
+ * destination. -retune measures the costs again
+ *
+ * Pixmaps and lαβ arrays come from a pool (pool.h) that keeps freed ones
+ * for the next image or preview level instead of returning them to the
+ * system. -poolcap MB bounds what it keeps (default 1024) and -poolstats
+ * prints its hit rate and the memory it kept when the run is done
+ *
+ * -kernel picks the transfer kernel: fast (the default, unless tuned),
+ * reference, or any kernel that ctbench reports, such as float or
+ * fast-high. The -unique kernels (fast-unique, float-unique, ...) gather
+ * statistics over the distinct colors of each image, which is much faster
+ * on graphics and skies. The
+ * fixed kernels run the whole conversion in integers (fixedpoint.h). ycbcr,
+ * cielab and oklab match the statistics in those spaces (colorspace.h)
+ * instead of lαβ; ycbcr needs no log or exp and is the cheapest
+ *
+ * -alpha takes the statistics from, and transfers, only the pixels whose
+ * alpha is not 0. -sourcemask and -destmask do the same with the pixels
+ * that are white in a mask image the size of the source or destination.
+ * Uncovered destination pixels are left as they are
+ *
+ * -histogram matches the whole distribution of each channel of the
+ * destination to the source's (histogram.h) instead of only its mean and
+ * standard deviation. -blend w takes w of the match and 1 - w of the mean
+ * and deviation transfer; the default is 1
+ *
+ * -reduce decodes each source at the smallest size that still covers the
+ * destination, which is all its statistics need: JPEG files at 1/2, 1/4 or
+ * 1/8 scale in the DCT, and files with MIP levels from the level that fits.
+ * The reduction is printed; ctbench -decodereport measures what it costs
+ *
+ * With one source and destination the window opens at once. A transfer of
+ * at most PREVIEWPIXELS pixels, from reduced decodes where the files allow,
+ * is shown first, then refined on a worker thread at twice the resolution
+ * per level up to the full image, which is the one written. The rescale,
+ * statistics and apply of each level are split over the tuned threads
+ *
+ * -batch transfers every source to the one destination without displaying
+ * anything, writing outdir/<source name>.png for each. The destination is
+ * converted once. The sources run on -threads workers (default the tuned
+ * count), which split the statistics and apply of large images into pieces
+ * and steal them from each other, starting a new source only when idle
+ *
+ * The tile modes spread one large image over many processes or machines
+ * that share only storage. An image is cut into tiles of -tilerows
+ * scanlines (default 1024), numbered from 0 at the top. -partial writes the
+ * lαβ statistics of -tiles first-last (default all) to a small file, reading
+ * one tile at a time; -merge combines such files into the statistics of the
+ * whole image; and -applytiles transfers tiles of the destination with the
+ * merged source and destination statistics, writing each tile to
+ * outdir/<destination name>.<tile>.png. The source is not scaled to the
+ * destination in these modes, and all the files must come from one kernel
+ *
+ * The transfer itself is the ColorTransfer object of transfer.h; this
+ * program only reads, writes and displays the images
+ *
+ * Author: Drake Hunter, 12/2/2019
+ * Credits: Ioannis Karamouzas, 10/20/19
+ */
+
+#include "transfer.h"
+#include "imagefile.h"
+#include "mask.h"
+#include "moments.h"
+#include "scheduler.h"
+#include "histogram.h"
+#include "autotune.h"
+#include "budget.h"
+
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+#include <string>
+#include <vector>
+#include <thread>
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <algorithm>
+#include <climits>
+#include <cmath>
+#include <chrono>
+#include <GL/glut.h>
+
+using namespace std;
+
+
+using std::string;
+
+//
+// Global variables and constants
+//
+const int DEFAULTWIDTH = 600; // default window dimensions if no image
+const int DEFAULTHEIGHT = 600;
+const int DEFAULTTILEROWS = 1024;  // scanlines in a tile for -partial and -applytiles
+
+int WinWidth, WinHeight;  // window width and height
+int DestImWidth, DestImHeight;    // dest image width and height
+
+int VpWidth, VpHeight;    // viewport width and height
+int Xoffset, Yoffset;     // viewport offset from lower left corner of window
+
+Pixel *display = NULL; // the transferred pixmap used for display
+int DisplayWidth, DisplayHeight;  // its size, smaller than the dest image for a preview
+
+//
+// The preview worker transfers at rising resolutions and hands each level
+// to the display under PreviewLock; a timer redraws when a level is ready,
+// and exits if the worker failed. Quitting stops the worker after the level
+// it is on and joins it before the display is freed
+//
+const long PREVIEWPIXELS = 65536;   // at most this many pixels in the first level
+const int PREVIEWPOLLMS = 30;       // milliseconds between checks for a new level
+mutex PreviewLock;
+atomic<int> PreviewLevels(0);       // levels handed to the display so far
+atomic<bool> PreviewDone(false);    // the worker has finished, with the full level or failed
+atomic<bool> PreviewFailed(false);  // a level could not be made
+atomic<bool> PreviewStop(false);    // quit was asked for
+thread PreviewWorker;
+int DrawnLevels = 0;
+
+Tuning Tune = defaulttuning();   // this host's kernel, threads and piece size (autotune.h)
+bool PoolReport = false;         // print the buffer pool's counts when done
+
+int pixformat = GL_RGBA;  // the pixel format used to correctly draw the image
+
+//
+// Routine to write the current framebuffer to an image file
+//
+void writeimage(string outfilename){
+  // make a pixmap that is the size of the window and grab OpenGL framebuffer into it
+  vector<Pixel> local_pixmap(long(WinWidth) * WinHeight);
+  glReadPixels(0, 0, WinWidth, WinHeight, pixformat, GL_UNSIGNED_BYTE, &local_pixmap[0]);
+
+  writepixmap(outfilename, &local_pixmap[0], WinWidth, WinHeight);
+}
+
+//
+// Routine to display a dest in the current window
+//
+void displayimage(){
+  lock_guard<mutex> lock(PreviewLock);
+  if(!display)
+    return;
+
+  // scale the image, or a smaller preview of it, to the viewport
+  glPixelZoom(float(VpWidth) / DisplayWidth, float(VpHeight) / DisplayHeight);
+  
+  // display starting at the lower lefthand corner of the viewport
+  glRasterPos2i(0, 0);
+
+  glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+  glDrawPixels(DisplayWidth, DisplayHeight, pixformat, GL_UNSIGNED_BYTE, display);
+}
+
+//
+//   Display Callback Routine: clear the screen and draw the current image
+//
+void handleDisplay(){
+  
+  // specify window clear (background) color to be opaque black
+  glClearColor(0, 0, 0, 1);
+  // clear window to background color
+  glClear(GL_COLOR_BUFFER_BIT);  
+  
+  // only draw the image if it is of a valid size
+  if(DestImWidth > 0 && DestImHeight > 0)
+    displayimage();
+  
+  // flush the OpenGL pipeline to the viewport
+  glFlush();
+}
+
+//
+//  Keyboard Callback Routine: 
+//  'w' or 'W' to write the image to file
+//  'q' or ESC - quit
+//
+void handleKey(unsigned char key, int, int){
+  string outfilename;
+  
+  switch(key){
+    case 'w':   // 'w' - write the image to a file
+    case 'W':
+      cout << "Output image filename? ";  // prompt user for output filename
+      cin >> outfilename;
+      writeimage(outfilename);
+      break;
+
+    case 'q':   // q or ESC - quit
+    case 'Q':
+    case 27:
+      PreviewStop = true;
+      if(PreviewWorker.joinable())
+        PreviewWorker.join();
+      poolfree(display);
+      exit(0);
+      
+    default:    // not a valid key -- just ignore it
+      return;
+  }
+}
+
+//
+//  Reshape Callback Routine: If the window is too small to fit the image,
+//  make a viewport of the maximum size that maintains the image proportions.
+//  Otherwise, size the viewport to match the image size. In either case, the
+//  viewport is centered in the window.
+//
+void handleReshape(int w, int h){
+  float imageaspect = (float)DestImWidth / (float)DestImHeight; // aspect ratio of image
+  float newaspect = (float)w / (float)h; // new aspect ratio of window
+  
+  // record the new window size in global variables for easy access
+  WinWidth = w;
+  WinHeight = h;
+  
+  // if the image fits in the window, viewport is the same size as the image
+  if(w >= DestImWidth && h >= DestImHeight){
+    Xoffset = (w - DestImWidth) / 2;
+    Yoffset = (h - DestImHeight) / 2;
+    VpWidth = DestImWidth;
+    VpHeight = DestImHeight;
+  }
+  // if the window is wider than the image, use the full window height
+  // and size the width to match the image aspect ratio
+  else if(newaspect > imageaspect){
+    VpHeight = h;
+    VpWidth = int(imageaspect * VpHeight);
+    Xoffset = int((w - VpWidth) / 2);
+    Yoffset = 0;
+  }
+  // if the window is narrower than the image, use the full window width
+  // and size the height to match the image aspect ratio
+  else{
+    VpWidth = w;
+    VpHeight = int(VpWidth / imageaspect);
+    Yoffset = int((h - VpHeight) / 2);
+    Xoffset = 0;
+  }
+  
+  // center the viewport in the window
+  glViewport(Xoffset, Yoffset, VpWidth, VpHeight);
+  
+  // viewport coordinates are simply pixel coordinates
+  glMatrixMode(GL_PROJECTION);
+  glLoadIdentity();
+  gluOrtho2D(0, VpWidth, 0, VpHeight);
+  glMatrixMode(GL_MODELVIEW);
+}
+
+//
+//  Timer Callback Routine: redraw when the preview worker has finished a
+//  level, and keep checking until the full resolution level is drawn. The
+//  finished worker is joined here, and the program exits if it failed
+//
+void handleTimer(int){
+  bool done = PreviewDone;
+  if(done && PreviewWorker.joinable())
+    PreviewWorker.join();
+  if(done && PreviewFailed){
+    poolfree(display);
+    exit(1);
+  }
+  int levels = PreviewLevels;
+  if(levels != DrawnLevels){
+    DrawnLevels = levels;
+    glutPostRedisplay();
+  }
+  if(!done)
+    glutTimerFunc(PREVIEWPOLLMS, handleTimer, 0);
+}
+
+/*
+   Make the mask of an image that has been scaled from width x height to
+   newwidth x newheight. A mask file, which must be the size of the image,
+   is scaled the same way; without one the mask is the alpha of pixels with
+   -alpha, and all of the image otherwise. Returns false if the mask file
+   cannot be used.
+*/
+bool makemask(const string &maskfile, bool alpha, const Pixel *pixels, int width, int height,
+              int newwidth, int newheight, Mask &mask){
+  if(maskfile.empty()){
+    if(alpha)
+      mask.fromalpha(pixels, newwidth, newheight);
+    else
+      mask.full(newwidth, newheight);
+    return true;
+  }
+
+  int maskwidth, maskheight;
+  Pixel *maskpixels = readpixmap(maskfile, maskwidth, maskheight);
+  if(!maskpixels)
+    return false;
+  if(maskwidth != width || maskheight != height){
+    cerr << "Mask " << maskfile << " is not the size of its image" << endl;
+    poolfree(maskpixels);
+    return false;
+  }
+  int scaledwidth, scaledheight;
+  Pixel *scaledmask = scalepixmap(maskpixels, width, height, newwidth, newheight,
+                                  scaledwidth, scaledheight, Tune.threads, Tune.piecepixels);
+  mask.fromimage(scaledmask, scaledwidth, scaledheight);
+  poolfree(maskpixels);
+  poolfree(scaledmask);
+  return true;
+}
+
+/*
+   Read a source image. With reduce it is decoded at the smallest size the
+   decoder offers that still covers width x height, which is all its
+   statistics need, and the reduction is reported.
+*/
+Pixel *readsource(const string &sourcefile, bool reduce, int width, int height,
+                  int &sourcewidth, int &sourceheight){
+  if(!reduce)
+    return readpixmap(sourcefile, sourcewidth, sourceheight);
+
+  int reduction;
+  Pixel *source = readreducedpixmap(sourcefile, width, height, sourcewidth, sourceheight, reduction);
+  if(source)
+    cout << sourcefile + " decoded at 1/" + to_string(reduction) + " scale, " +
+            to_string(sourcewidth) + "x" + to_string(sourceheight) + "\n" << flush;
+  return source;
+}
+
+// destinations of up to this many covered pixels are written a band at a time, unsplit
+const long STREAMPIXELS = 1 << 20;
+
+//
+// One source of a batch, and what each of its stages hands to the next
+//
+struct BatchJob{
+  string sourcefile;
+  ColorTransfer transfer;
+  Pixel *source;              // the decoded source, until it is scaled
+  unique_ptr<PixmapScale> scale;
+  Pixel *scaled;              // the source scaled to the destination
+  long bandrows;              // scanlines of it in a scaling piece
+  PoolVector<Pixel> covered;  // covered source pixels, until their statistics are taken
+  vector<LabStats> parts;     // the statistics of each piece of them
+  PoolVector<Pixel> result;   // transferred destination pixels of a split apply
+  LabImage matched;           // the destination matched to the source, with -histogram
+  atomic<long> remaining;     // pieces of the stage still to finish
+};
+
+//
+// The stages of the jobs of a batch, run as tasks of a TaskScheduler
+// (scheduler.h): decode, scale and mask, statistics, apply, and write. The
+// scaling, statistics and apply of an image with more than a piece of
+// pixels are split into pieces of the tuned size (autotune.h) spawned as
+// tasks; the task that finishes the last piece of a stage goes on to the
+// next.
+//
+struct Batch{
+  const TransferKernel *kernel;
+  string outdir;
+  bool alpha, reduce;
+  const LabHistogram *desthistogram;   // with -histogram, to match each source to
+  double blend;
+  const Pixel *dest;
+  int width, height;
+  const Mask &destmask;
+  const LabImage &destimage;
+  vector<BatchJob> jobs;
+  long piecepixels;   // pixels in a statistics or apply task
+  TaskScheduler scheduler;
+  atomic<int> failures;
+
+  Batch(const TransferKernel *k, const string &dir, bool a, bool r, const LabHistogram *hist,
+        double bl, const Pixel *d, int w, int h, const Mask &mask, const LabImage &image,
+        const vector<string> &sourcefiles, int nthreads)
+    : kernel(k), outdir(dir), alpha(a), reduce(r), desthistogram(hist), blend(bl),
+      dest(d), width(w), height(h),
+      destmask(mask), destimage(image), jobs(sourcefiles.size()),
+      piecepixels(max(Tune.piecepixels, 1L)), scheduler(nthreads),
+      failures(0){
+    for(size_t i = 0; i < jobs.size(); i++){
+      jobs[i].sourcefile = sourcefiles[i];
+      jobs[i].transfer = ColorTransfer(kernel);
+    }
+  }
+
+  void start(long i);
+  void scalepiece(BatchJob &job, long piece);
+  void maskstage(BatchJob &job);
+  void statspiece(BatchJob &job, long piece);
+  void applystage(BatchJob &job);
+  void applypiece(BatchJob &job, long piece);
+  const LabImage &applyimage(const BatchJob &job) const { return desthistogram ? job.matched : destimage; }
+  string outfile(const BatchJob &job) const;
+};
+
+/*
+   Spawn every piece of a stage but the first, which runs here, so that a
+   small image runs whole on this worker.
+*/
+template<class Piece>
+static void runpieces(TaskScheduler &scheduler, BatchJob &job, long pieces, const Piece &piece){
+  job.remaining = pieces;
+  for(long k = pieces - 1; k > 0; k--)
+    scheduler.spawn([&job, piece, k](){ piece(job, k); });
+  piece(job, 0);
+}
+
+/*
+   Read a source and scale it to the destination, in bands of about a piece
+   of pixels.
+*/
+void Batch::start(long i){
+  BatchJob &job = jobs[i];
+  int sourcewidth, sourceheight;
+  job.source = readsource(job.sourcefile, reduce, width, height, sourcewidth, sourceheight);
+  if(!job.source){
+    failures++;
+    return;
+  }
+  job.scale.reset(new PixmapScale(job.source, sourcewidth, sourceheight, width, height));
+  job.scaled = poolnew<Pixel>(long(job.scale->width) * job.scale->height);
+  job.bandrows = job.scale->bandrows(piecepixels);
+  long bands = max((job.scale->height + job.bandrows - 1) / job.bandrows, 1L);
+  runpieces(scheduler, job, bands, [this](BatchJob &job, long k){ scalepiece(job, k); });
+}
+
+void Batch::scalepiece(BatchJob &job, long piece){
+  long first = piece * job.bandrows;
+  job.scale->band(first, max(min(job.bandrows, job.scale->height - first), 0L), job.scaled);
+  if(--job.remaining > 0)
+    return;
+
+  poolfree(job.source);
+  job.source = NULL;
+  maskstage(job);
+}
+
+/*
+   Gather the pixels of the scaled source its mask covers, then take their
+   statistics. With -histogram the source is converted whole and the
+   destination matched to it instead.
+*/
+void Batch::maskstage(BatchJob &job){
+  int scaledwidth = job.scale->width, scaledheight = job.scale->height;
+  job.scale.reset();
+  Pixel *scaledsource = job.scaled;
+  job.scaled = NULL;
+
+  Mask sourcemask;
+  makemask("", alpha, scaledsource, scaledwidth, scaledheight,
+           scaledwidth, scaledheight, sourcemask);
+  if(sourcemask.covered() == 0 || destmask.covered() == 0){
+    cerr << "The masks leave no pixels to transfer from " << job.sourcefile << endl;
+    poolfree(scaledsource);
+    failures++;
+    return;
+  }
+  job.covered.resize(sourcemask.covered());
+  sourcemask.gather(scaledsource, &job.covered[0]);
+  poolfree(scaledsource);
+
+  if(desthistogram){
+    LabImage sourceimage;
+    job.transfer.convert(&job.covered[0], long(job.covered.size()), sourceimage);
+    PoolVector<Pixel>().swap(job.covered);
+    histogrammatch(sourceimage, destimage, *desthistogram, blend, job.matched);
+    job.transfer.setstats(job.matched.stats, job.matched.stats);
+    applystage(job);
+    return;
+  }
+
+  long pieces = (long(job.covered.size()) + piecepixels - 1) / piecepixels;
+  job.parts.resize(pieces);
+  runpieces(scheduler, job, pieces, [this](BatchJob &job, long k){ statspiece(job, k); });
+}
+
+/*
+   The statistics of one piece of the covered source pixels. The last piece
+   to finish merges them all, in order, and goes on to the apply.
+*/
+void Batch::statspiece(BatchJob &job, long piece){
+  long start = piece * piecepixels;
+  long n = min(piecepixels, long(job.covered.size()) - start);
+  kernel->stats(&job.covered[start], n, job.parts[piece]);
+  if(--job.remaining > 0)
+    return;
+
+  LabStats stats = {0, {0, 0, 0}, {0, 0, 0}};
+  for(size_t k = 0; k < job.parts.size(); k++)
+    mergestats(stats, job.parts[k]);
+  PoolVector<Pixel>().swap(job.covered);
+  job.transfer.setstats(stats, destimage.stats);
+  applystage(job);
+}
+
+/*
+   A destination of at most STREAMPIXELS is transferred straight into the
+   file a band of scanlines at a time. A larger one is applied in pieces
+   into the job's result, which the last piece to finish writes.
+*/
+void Batch::applystage(BatchJob &job){
+  long n = destmask.covered();
+  if(n <= STREAMPIXELS){
+    if(!writetransfer(outfile(job), job.transfer, dest, width, height, destmask,
+                      &applyimage(job)))
+      failures++;
+    job.matched = LabImage();
+    return;
+  }
+  job.result.resize(n);
+  runpieces(scheduler, job, (n + piecepixels - 1) / piecepixels,
+            [this](BatchJob &job, long k){ applypiece(job, k); });
+}
+
+void Batch::applypiece(BatchJob &job, long piece){
+  long start = piece * piecepixels;
+  long n = min(piecepixels, long(job.result.size()) - start);
+  job.transfer.apply(applyimage(job), start, n, &job.result[start]);
+  if(--job.remaining > 0)
+    return;
+
+  if(!writemasked(outfile(job), dest, width, height, destmask, &job.result[0]))
+    failures++;
+  PoolVector<Pixel>().swap(job.result);
+  job.matched = LabImage();
+}
+
+// outdir/name.png for source dir/name.jpg
+string Batch::outfile(const BatchJob &job) const{
+  size_t slash = job.sourcefile.find_last_of('/');
+  string name = slash == string::npos ? job.sourcefile : job.sourcefile.substr(slash + 1);
+  return outdir + "/" + name.substr(0, name.find_last_of('.')) + ".png";
+}
+
+/*
+   Transfer the colors of every source to one destination and write the
+   result for source dir/name.jpg as outdir/name.png. The covered pixels of
+   the destination are converted to lαβ once; each source then needs only
+   its statistics and the apply. The jobs run on nthreads workers that
+   steal the pieces of large images from each other and start a new source
+   only when there is nothing else to do, so memory holds the destination
+   and about nthreads sources and results. Returns the number of sources
+   that failed.
+*/
+int transfermany(const TransferKernel *kernel, const string &destfile, const string &outdir,
+                 const vector<string> &sourcefiles, int nthreads,
+                 bool alpha, const string &destmaskfile, bool reduce,
+                 bool histogram, double blend){
+  int width, height;
+  Pixel *dest = readpixmap(destfile, width, height);
+  Mask destmask;
+  if(!dest || !makemask(destmaskfile, alpha, dest, width, height, width, height, destmask)){
+    poolfree(dest);
+    return int(sourcefiles.size());
+  }
+  LabImage destimage;
+  Pixel *covered = poolnew<Pixel>(destmask.covered());
+  destmask.gather(dest, covered);
+  ColorTransfer(kernel).convert(covered, destmask.covered(), destimage);
+  poolfree(covered);
+
+  LabHistogram *desthistogram = NULL;
+  if(histogram)
+    desthistogram = new LabHistogram(imagehistogram(destimage, nthreads, Tune.piecepixels));
+
+  Batch batch(kernel, outdir, alpha, reduce, desthistogram, blend, dest, width, height,
+              destmask, destimage, sourcefiles, nthreads);
+  batch.scheduler.run(long(sourcefiles.size()), [&batch](long i){ batch.start(i); });
+
+  delete desthistogram;
+  poolfree(dest);
+  return batch.failures;
+}
+
+/*
+   Tiles are bands of tilerows scanlines numbered from the top of an image.
+   Compute the statistics of tiles first to last of an image, reading one
+   tile at a time, and write them to statsfile for mergepartials. With
+   -alpha only the pixels whose alpha is not 0 count. Returns false on
+   failure.
+*/
+bool partialstats(const TransferKernel *kernel, const string &imagefile, int tilerows,
+                  int first, int last, bool alpha, const string &statsfile){
+  LabStats stats = {0, {0, 0, 0}, {0, 0, 0}};
+  int height = INT_MAX;
+  for(int tile = first; tile <= last && long(tile) * tilerows < height; tile++){
+    int width, rows;
+    Pixel *pixels = readscanlines(imagefile, tile * tilerows, tilerows, width, rows, height);
+    if(!pixels)
+      return false;
+    Mask mask;
+    makemask("", alpha, pixels, width, rows, width, rows, mask);
+    if(mask.covered() > 0){
+      LabStats part;
+      imagestats(kernel, pixels, mask, part);
+      mergestats(stats, part);
+    }
+    poolfree(pixels);
+  }
+  if(stats.count == 0){
+    cerr << "Tiles " << first << " to " << last << " of " << imagefile << " have no pixels" << endl;
+    return false;
+  }
+  return writestatsfile(statsfile, kernel->name, stats);
+}
+
+/*
+   Merge any number of partial statistics files, which must all come from
+   the same kernel, into the statistics of the whole image.
+*/
+bool mergepartials(const string &statsfile, const vector<string> &partialfiles){
+  LabStats stats = {0, {0, 0, 0}, {0, 0, 0}};
+  string kernel;
+  for(size_t i = 0; i < partialfiles.size(); i++){
+    string partkernel;
+    LabStats part;
+    if(!readstatsfile(partialfiles[i], partkernel, part))
+      return false;
+    if(i > 0 && partkernel != kernel){
+      cerr << partialfiles[i] << " is from kernel " << partkernel << ", not " << kernel << endl;
+      return false;
+    }
+    kernel = partkernel;
+    mergestats(stats, part);
+  }
+  return writestatsfile(statsfile, kernel, stats);
+}
+
+/*
+   Transfer tiles first to last of a destination with the statistics of the
+   source and of the whole destination, both from statistics files of this
+   kernel, writing tile t to outdir/<destination name>.<t>.png. nthreads
+   tiles are transferred at a time. Returns the number of tiles that failed,
+   or -1 if the statistics cannot be used.
+*/
+int applytiles(const TransferKernel *kernel, const string &sourcestatsfile,
+               const string &deststatsfile, const string &destfile, const string &outdir,
+               int tilerows, int first, int last, int nthreads, bool alpha){
+  LabStats sourcestats, deststats;
+  string statskernel[2];
+  if(!readstatsfile(sourcestatsfile, statskernel[0], sourcestats) ||
+     !readstatsfile(deststatsfile, statskernel[1], deststats))
+    return -1;
+  for(int i = 0; i < 2; i++)
+    if(statskernel[i] != kernel->name){
+      cerr << (i == 0 ? sourcestatsfile : deststatsfile) << " is from kernel " << statskernel[i]
+           << ", use -kernel " << statskernel[i] << endl;
+      return -1;
+    }
+  ColorTransfer transfer(kernel);
+  transfer.setstats(sourcestats, deststats);
+
+  size_t slash = destfile.find_last_of('/');
+  string name = slash == string::npos ? destfile : destfile.substr(slash + 1);
+  name = name.substr(0, name.find_last_of('.'));
+
+  atomic<int> next(first), failures(0), height(INT_MAX);
+  vector<thread> workers;
+  for(int t = 0; t < nthreads && t <= last - first; t++)
+    workers.push_back(thread([&](){
+      for(int tile = next++; tile <= last && long(tile) * tilerows < height; tile = next++){
+        int width, rows, imageheight;
+        Pixel *pixels = readscanlines(destfile, tile * tilerows, tilerows, width, rows, imageheight);
+        if(!pixels){
+          failures++;
+          continue;
+        }
+        height = imageheight;
+        Mask mask;
+        makemask("", alpha, pixels, width, rows, width, rows, mask);
+        string outfile = outdir + "/" + name + "." + to_string(tile) + ".png";
+        if(!writetransfer(outfile, transfer, pixels, width, rows, mask))
+          failures++;
+        poolfree(pixels);
+      }
+    }));
+  for(size_t t = 0; t < workers.size(); t++)
+    workers[t].join();
+
+  return failures;
+}
+
+/*
+   Transfer a source to a destination file within budgetms, as the tier
+   choosetier picks for their sizes says. The tier, its estimated time and
+   loss, and the time the transfer took are printed.
+*/
+bool budgettransfer(const CostModel &costs, double budgetms, const string &sourcefile,
+                    const string &destfile, const string &outfile){
+  chrono::steady_clock::time_point start = chrono::steady_clock::now();
+  int sourcewidth, sourceheight, destwidth, destheight;
+  if(!readimagesize(sourcefile, sourcewidth, sourceheight) ||
+     !readimagesize(destfile, destwidth, destheight))
+    return false;
+  BudgetTier tier = choosetier(costs, budgetms, sourcewidth, sourceheight, isjpeg(sourcefile),
+                               destwidth, destheight, isjpeg(destfile));
+  if(!tier.fits)
+    cerr << "No tier fits in " << budgetms << " ms, using the fastest" << endl;
+
+  int width, height, reduction;
+  Pixel *result = tiertransfer(Tune, tier, sourcefile, destfile, width, height, reduction);
+  bool written = result && writepixmap(outfile, result, width, height);
+  poolfree(result);
+
+  double ms = chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+  printf("budget %g ms: tier %d of %d, kernel %s, source at 1/%d, statistics from 1 in %d scanlines\n",
+         budgetms, tier.level, tier.levels, tier.kernel->name, reduction, tier.stride);
+  printf("estimated %.1f ms and a mean dE of %.2f in RGB from the full quality transfer, took %.1f ms\n",
+         tier.ms, tier.loss, ms);
+  return written;
+}
+
+//
+// What the preview worker transfers, from the command line
+//
+struct PreviewJob{
+  const TransferKernel *kernel;
+  string sourcefile, destfile, outfile;
+  string sourcemaskfile, destmaskfile;
+  bool alpha, reduce;
+  bool histogram;                  // match histograms, blended with Reinhard by blend
+  double blend;
+  int sourcewidth, sourceheight;   // full sizes, which mask files must match
+};
+
+/*
+   Transfer a source to a destination, each at the size it was read, at
+   width x height: both are scaled there, masks are made at that size, and the result is returned in a new
+   pixmap of levelwidth x levelheight, which scaling can leave a pixel short
+   of the size asked for. At the size of the destination this is the whole
+   single image transfer. Returns NULL, with empty set, if the masks leave no
+   pixels, and also on failure.
+*/
+Pixel *transferlevel(const PreviewJob &job, const Pixel *source, int sourcewidth, int sourceheight,
+                     const Pixel *dest, int destwidth, int destheight, int width, int height,
+                     int &levelwidth, int &levelheight, bool &empty){
+  int scaledwidth, scaledheight;
+  Pixel *scaledsource = scalepixmap(source, sourcewidth, sourceheight, width, height,
+                                    scaledwidth, scaledheight, Tune.threads, Tune.piecepixels);
+  Pixel *level = scalepixmap(dest, destwidth, destheight, width, height,
+                             levelwidth, levelheight, Tune.threads, Tune.piecepixels);
+
+  // find the pixels to take the statistics from and to transfer
+  Mask sourcemask, destmask;
+  bool masked = makemask(job.sourcemaskfile, job.alpha, scaledsource, job.sourcewidth,
+                         job.sourceheight, scaledwidth, scaledheight, sourcemask) &&
+                makemask(job.destmaskfile, job.alpha, level, DestImWidth, DestImHeight,
+                         levelwidth, levelheight, destmask);
+  empty = masked && (sourcemask.covered() == 0 || destmask.covered() == 0);
+  if(!masked || empty){
+    poolfree(scaledsource);
+    poolfree(level);
+    return NULL;
+  }
+
+  //Perform calculations on the covered pixels, split as Tune says, keeping
+  //the alpha and the uncovered pixels of the destination
+  ColorTransfer transfer(job.kernel);
+  Pixel *sourcecovered = poolnew<Pixel>(sourcemask.covered());
+  Pixel *covered = poolnew<Pixel>(destmask.covered());
+  sourcemask.gather(scaledsource, sourcecovered);
+  destmask.gather(level, covered);
+  if(job.histogram){
+    LabImage sourceimage, destimage, matched;
+    transfer.convert(sourcecovered, sourcemask.covered(), sourceimage);
+    transfer.convert(covered, destmask.covered(), destimage);
+    histogrammatch(sourceimage, destimage, imagehistogram(destimage, Tune.threads, Tune.piecepixels),
+                   job.blend, matched, Tune.threads, Tune.piecepixels);
+    transfer.setstats(matched.stats, matched.stats);
+    tunedapply(Tune, transfer, matched, covered);
+  }
+  else{
+    LabStats sourcestats, deststats;
+    tunedstats(Tune, job.kernel, sourcecovered, sourcemask.covered(), sourcestats);
+    tunedstats(Tune, job.kernel, covered, destmask.covered(), deststats);
+    transfer.setstats(sourcestats, deststats);
+    tunedapply(Tune, transfer, covered, covered, destmask.covered());
+  }
+  destmask.scatter(covered, level);
+  poolfree(sourcecovered);
+  poolfree(covered);
+  poolfree(scaledsource);
+  return level;
+}
+
+//
+// Print how well the buffer pool (pool.h) served the run
+//
+void reportpool(){
+  PoolStats stats = bufferpool().stats();
+  const double MB = 1 << 20;
+  cout << "buffer pool: " << stats.requests << " requests, " << stats.hits << " hits ("
+       << (stats.requests > 0 ? 100 * stats.hits / stats.requests : 0) << "%), "
+       << long(stats.retained / MB) << " MB retained, " << long(stats.peakinuse / MB)
+       << " MB peak in use, " << long(stats.mapped / MB) << " MB mapped, "
+       << long(stats.unmapped / MB) << " MB returned" << endl;
+}
+
+// hand a finished level to the display, which owns it from then on
+void showlevel(Pixel *level, int width, int height){
+  lock_guard<mutex> lock(PreviewLock);
+  poolfree(display);
+  display = level;
+  DisplayWidth = width;
+  DisplayHeight = height;
+  PreviewLevels++;
+}
+
+/*
+   The preview worker. The first level is at most PREVIEWPIXELS, from
+   reduced decodes of both images where the files allow it, so it is ready
+   in about the same time whatever the size of the images. Each following
+   level doubles the resolution up to the full transfer, which is written
+   to the output file, if there is one. Returns false if a level cannot be
+   made, and true when done or stopped by PreviewStop between levels.
+*/
+bool previewlevels(PreviewJob job){
+  int shift = 0;
+  while((long(DestImWidth) >> shift) * (long(DestImHeight) >> shift) > PREVIEWPIXELS)
+    shift++;
+
+  int sourcewidth, sourceheight, width, height, levelwidth, levelheight;
+  int sourcereduction = 1, destreduction = 1;
+  Pixel *source = NULL, *dest = NULL;
+  bool empty;
+  if(shift > 0){
+    int previewwidth = max(DestImWidth >> shift, 1), previewheight = max(DestImHeight >> shift, 1);
+    source = readreducedpixmap(job.sourcefile, previewwidth, previewheight,
+                               sourcewidth, sourceheight, sourcereduction);
+    dest = readreducedpixmap(job.destfile, previewwidth, previewheight,
+                             width, height, destreduction);
+    if(source && dest){
+      Pixel *level = transferlevel(job, source, sourcewidth, sourceheight, dest, width, height,
+                                   previewwidth, previewheight, levelwidth, levelheight, empty);
+      if(level)
+        showlevel(level, levelwidth, levelheight);
+      else if(!empty){
+        poolfree(source);
+        poolfree(dest);
+        return false;
+      }
+    }
+
+    // images that could not be read smaller are kept for the next levels
+    if(sourcereduction > 1 || job.reduce){
+      poolfree(source);
+      source = NULL;
+    }
+    if(destreduction > 1){
+      poolfree(dest);
+      dest = NULL;
+    }
+  }
+
+  if(!dest)
+    dest = readpixmap(job.destfile, width, height);
+  if(dest && !source)
+    source = readsource(job.sourcefile, job.reduce, DestImWidth, DestImHeight,
+                        sourcewidth, sourceheight);
+  bool read = dest && source;
+  if(!read || PreviewStop){
+    poolfree(source);
+    poolfree(dest);
+    return read;
+  }
+  if(job.reduce){
+    job.sourcewidth = sourcewidth;
+    job.sourceheight = sourceheight;
+  }
+
+  for(shift = max(shift - 1, 0); shift >= 0 && !PreviewStop; shift--){
+    Pixel *level = transferlevel(job, source, sourcewidth, sourceheight, dest, width, height,
+                                 max(DestImWidth >> shift, 1), max(DestImHeight >> shift, 1),
+                                 levelwidth, levelheight, empty);
+    if(level)
+      showlevel(level, levelwidth, levelheight);
+    else if(shift == 0 || !empty){
+      if(empty)
+        cerr << "The masks leave no pixels to transfer" << endl;
+      poolfree(source);
+      poolfree(dest);
+      return false;
+    }
+  }
+  poolfree(source);
+  poolfree(dest);
+  if(PreviewStop)
+    return true;
+
+  //Write the image to inputted file
+  if(!job.outfile.empty()){
+    lock_guard<mutex> lock(PreviewLock);
+    writepixmap(job.outfile, display, DisplayWidth, DisplayHeight);
+  }
+  if(PoolReport)
+    reportpool();
+  return true;
+}
+
+// the preview worker's thread, which leaves failures to the timer to report
+void preview(PreviewJob job){
+  if(!previewlevels(job))
+    PreviewFailed = true;
+  PreviewDone = true;
+}
+
+/*
+   Main program to read the source and destination images, transfer the
+   colors of the source to the destination, optionally save the result in
+   a file, and display it.
+*/
+int main(int argc, char *argv[]){
+
+  // set up the default window if no image is given
+  WinWidth = DEFAULTWIDTH;
+  WinHeight = DEFAULTHEIGHT;
+  DestImWidth = 0;
+  DestImHeight = 0;
+
+  // separate the options from the image file names
+  const TransferKernel *kernel = NULL;   // fast, or the host's tuned one, unless given
+  string mode;   // empty for a single transfer
+  bool alpha = false, reduce = false, histogram = false, retune = false;
+  double blend = 1;
+  double budgetms = 0;   // for -budget
+  string sourcemaskfile, destmaskfile;
+  int nthreads = 0;   // the host's tuned thread count unless given
+  int tilerows = DEFAULTTILEROWS, firsttile = 0, lasttile = INT_MAX;
+  vector<string> files;
+  bool usage = false;
+  for(int i = 1; i < argc; i++){
+    string arg = argv[i];
+    if(arg == "-kernel" && i + 1 < argc){
+      kernel = findkernel(argv[++i]);
+      if(!kernel){
+        cerr << "Unknown kernel " << argv[i] << endl;
+        return 1;
+      }
+    }
+    else if(arg == "-threads" && i + 1 < argc)
+      nthreads = max(atoi(argv[++i]), 1);
+    else if(arg == "-tilerows" && i + 1 < argc)
+      tilerows = max(atoi(argv[++i]), 1);
+    else if(arg == "-tiles" && i + 1 < argc){
+      int n = sscanf(argv[++i], "%d-%d", &firsttile, &lasttile);
+      if(n == 1)
+        lasttile = firsttile;
+      if(n < 1 || firsttile < 0 || lasttile < firsttile)
+        usage = true;
+    }
+    else if((arg == "-batch" || arg == "-partial" || arg == "-merge" || arg == "-applytiles") &&
+            mode.empty())
+      mode = arg.substr(1);
+    else if(arg == "-budget" && i + 1 < argc && mode.empty()){
+      mode = "budget";
+      budgetms = atof(argv[++i]);
+      if(budgetms <= 0)
+        usage = true;
+    }
+    else if(arg == "-alpha")
+      alpha = true;
+    else if(arg == "-reduce")
+      reduce = true;
+    else if(arg == "-retune")
+      retune = true;
+    else if(arg == "-poolcap" && i + 1 < argc)
+      bufferpool().setcap(size_t(max(atol(argv[++i]), 0L)) << 20);
+    else if(arg == "-poolstats")
+      PoolReport = true;
+    else if(arg == "-histogram")
+      histogram = true;
+    else if(arg == "-blend" && i + 1 < argc){
+      blend = atof(argv[++i]);
+      if(blend < 0 || blend > 1)
+        usage = true;
+    }
+    else if(arg == "-sourcemask" && i + 1 < argc)
+      sourcemaskfile = argv[++i];
+    else if(arg == "-destmask" && i + 1 < argc)
+      destmaskfile = argv[++i];
+    else if(arg[0] != '-' && (!mode.empty() || files.size() < 3))
+      files.push_back(arg);
+    else
+      usage = true;
+  }
+  if((!mode.empty() || reduce) && !sourcemaskfile.empty())
+    usage = true;
+  if(reduce && mode != "" && mode != "batch")
+    usage = true;
+  if(mode != "" && mode != "batch" && (!destmaskfile.empty() || histogram))
+    usage = true;
+  if(blend != 1 && !histogram)
+    usage = true;
+  if(mode == "budget" && (kernel || alpha || nthreads > 0))
+    usage = true;
+  if(mode == "" && retune && files.empty() && argc == 2){
+    Tune = hosttuning(true);
+    hostcosts(Tune, true);
+    return 0;
+  }
+  if(mode == "")
+    usage = usage || (files.size() != 2 && files.size() != 3);
+  else if(mode == "budget")
+    usage = usage || files.size() != 3;
+  else if(mode == "batch" || mode == "merge")
+    usage = usage || files.size() < (mode == "batch" ? 3 : 2);
+  else
+    usage = usage || files.size() != (mode == "partial" ? 2 : 4);
+  if(usage){
+    cerr << "usage: colortransfer [-kernel name] [-alpha] [-reduce | -sourcemask mask.png] [-destmask mask.png]" << endl;
+    cerr << "                     [-histogram [-blend w]] source.png destination.png [outfile.png]" << endl;
+    cerr << "       colortransfer [-kernel name] [-alpha] [-reduce] [-destmask mask.png] [-threads n]" << endl;
+    cerr << "                     [-histogram [-blend w]] -batch destination.png outdir source.png ..." << endl;
+    cerr << "       colortransfer [-kernel name] [-alpha] [-tilerows n] [-tiles first-last]" << endl;
+    cerr << "                     -partial image.png partial.stats" << endl;
+    cerr << "       colortransfer -merge image.stats partial.stats ..." << endl;
+    cerr << "       colortransfer [-kernel name] [-alpha] [-tilerows n] [-tiles first-last] [-threads n]" << endl;
+    cerr << "                     -applytiles source.stats destination.stats destination.png outdir" << endl;
+    cerr << "       colortransfer -budget ms source.png destination.png outfile.png" << endl;
+    cerr << "       colortransfer -retune" << endl;
+    cerr << "       any of which also takes [-poolcap MB] [-poolstats]" << endl;
+    cerr << "The first run on a host tunes itself, writing ~/.colortransfer-tuning, and the first" << endl;
+    cerr << "-budget run calibrates, writing ~/.colortransfer-costs; -retune does both again" << endl;
+    return 1;
+  }
+
+  // the tile files record their kernel, so only the other modes take the tuned one
+  if(mode == "" || mode == "batch" || mode == "applytiles" || mode == "budget" || retune)
+    Tune = hosttuning(retune);
+  if(!kernel)
+    kernel = findkernel(mode == "" || mode == "batch" ? Tune.kernel : "fast");
+  if(nthreads > 0)
+    Tune.threads = nthreads;
+  nthreads = Tune.threads;
+
+  if(mode == "batch"){
+    vector<string> sources(files.begin() + 2, files.end());
+    int failures = transfermany(kernel, files[0], files[1], sources, nthreads,
+                                alpha, destmaskfile, reduce, histogram, blend);
+    if(failures > 0)
+      cerr << failures << " of " << sources.size() << " transfers failed" << endl;
+    if(PoolReport)
+      reportpool();
+    return failures > 0 ? 1 : 0;
+  }
+  if(mode == "budget"){
+    bool done = budgettransfer(hostcosts(Tune, retune), budgetms, files[0], files[1], files[2]);
+    if(PoolReport)
+      reportpool();
+    return done ? 0 : 1;
+  }
+  if(mode == "partial"){
+    bool done = partialstats(kernel, files[0], tilerows, firsttile, lasttile, alpha, files[1]);
+    if(PoolReport)
+      reportpool();
+    return done ? 0 : 1;
+  }
+  if(mode == "merge")
+    return mergepartials(files[0], vector<string>(files.begin() + 1, files.end())) ? 0 : 1;
+  if(mode == "applytiles"){
+    int failures = applytiles(kernel, files[0], files[1], files[2], files[3], tilerows,
+                              firsttile, lasttile, nthreads, alpha);
+    if(failures > 0)
+      cerr << failures << " tiles failed" << endl;
+    if(PoolReport)
+      reportpool();
+    return failures != 0 ? 1 : 0;
+  }
+
+  // the window opens at the size of the destination while the preview worker transfers
+  PreviewJob job;
+  job.kernel = kernel;
+  job.sourcefile = files[0];
+  job.destfile = files[1];
+  job.outfile = files.size() == 3 ? files[2] : "";
+  job.sourcemaskfile = sourcemaskfile;
+  job.destmaskfile = destmaskfile;
+  job.alpha = alpha;
+  job.reduce = reduce;
+  job.histogram = histogram;
+  job.blend = blend;
+  if(!readimagesize(files[0], job.sourcewidth, job.sourceheight) ||
+     !readimagesize(files[1], DestImWidth, DestImHeight))
+    return 1;
+  PreviewWorker = thread(preview, job);
+
+  WinWidth = DestImWidth;
+  WinHeight = DestImHeight;
+
+  // start up the glut utilities
+  glutInit(&argc, argv);
+
+  // create the graphics window, giving width, height, and title text
+  glutInitDisplayMode(GLUT_SINGLE | GLUT_RGBA);
+  glutInitWindowSize(WinWidth, WinHeight);
+  glutCreateWindow("Color Transfer");
+  
+  // set up the callback routines to be called when glutMainLoop() detects
+  // an event
+  glutDisplayFunc(handleDisplay); // display callback
+  glutKeyboardFunc(handleKey);    // keyboard key press callback
+  glutReshapeFunc(handleReshape); // window resize callback
+  glutTimerFunc(PREVIEWPOLLMS, handleTimer, 0);  // preview level check
+
+  // Enter GLUT's event loop
+  glutMainLoop();
+
+  return 0;
+}
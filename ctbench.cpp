@@ -0,0 +1,1505 @@
+/*
+ * Regression harness for the color transfer kernels
+ *
+ * Command line parameters are as follows:
+ *
+ * ctbench [-update] [-baselines file] [-accuracy frac] [-psnr dB]
+ *         [-speed] [-slowdown frac] [-repeat n] [imagedir]
+ * ctbench -mathreport
+ * ctbench -statsreport [gigapixels]
+ * ctbench -decodereport [-repeat n] [imagedir]
+ * ctbench -histogramreport [-repeat n] [imagedir]
+ * ctbench -poolreport [-repeat n] [imagedir]
+ * ctbench -tilereport [imagedir]
+ * ctbench -incrementalreport [imagedir]
+ * ctbench -budgetreport [imagedir]
+ *
+ * Every kernel in transferkernels is run against the double-precision
+ * reference over each image in imagedir (default images), using the next
+ * image in the directory as the source, over the first of those pairs
+ * posterized, which the -unique kernels must take as palettes, and over
+ * synthetic gradients.
+ * The max and mean ΔE in lαβ and in RGB, the PSNR against the reference and
+ * the megapixels per second of every kernel are compared with the stored
+ * baselines (default ctbench.baselines). Each -unique kernel must also be
+ * within UNIQUELEVELS per channel of its per-pixel twin, as it sums the
+ * statistics per color, in another order. The program exits with status 1
+ * when a kernel is less accurate than its baseline allows, when a -unique
+ * kernel is further from its twin, when the posterized case is not a
+ * palette for the -unique kernels, when the reference kernel run in
+ * stages differs in any byte from referencetransfer, or when there is no
+ * baselines file. The committed baselines were recorded on one machine,
+ * so their speeds only hold there; -speed also fails a kernel slower than
+ * its baseline allows, for baselines recorded with -update on this one.
+ * The ycbcr, cielab and oklab kernels match the statistics in another
+ * color space, so their distance from the reference is how much the space
+ * changes the result; their baselines only catch drift.
+ * -update rewrites the baselines from this run instead.
+ *
+ * -mathreport prints the error of every fastmath.h precision over the
+ * inputs the transfer produces instead, and exits with status 1 if the
+ * worst log10 or exp10 error is more than 5% beyond the bound fastmath.h
+ * records, which is rounded to two figures.
+ *
+ * -statsreport accumulates the lαβ statistics of synthetic images of a
+ * hundredth, a tenth and all of gigapixels (default 1, at least 1e-4)
+ * with LabMoments, with LabMoments in merged shards and with plain sums,
+ * and prints their error against a compensated two-pass double reference.
+ * It exits with status 1 if LabMoments, whole or in merged shards, is
+ * further than 1e-11 from the means or 1e-10 relative from the standard
+ * deviations, as moments.h promises from 0.1 gigapixels up; the bounds
+ * grow as the square root of how much smaller an image is.
+ *
+ * -decodereport times the reduced decodes of readreducedpixmap against a
+ * full decode of each image in imagedir, with the error each reduction
+ * puts in the statistics and in a transfer from the image. It exits with
+ * status 1 if a decode at full scale differs from the full decode, or a
+ * reduction of an image of 16 MP or more puts in more error than a large
+ * photograph takes.
+ *
+ * -histogramreport times the mean and deviation transfer and histogram
+ * matching (histogram.h) from a converted destination, and prints how far
+ * each channel of the result is from the source's distribution. It exits
+ * with status 1 if matching at blend 0 is more than a level from the mean
+ * and deviation transfer, or at blend 1 is not closer to the sources.
+ *
+ * -poolreport runs rounds of whole transfers between the images, reading,
+ * scaling, converting and applying, with the buffer pool (pool.h) off and
+ * at its default cap, and prints the time, page faults and pool hits of
+ * each round. It exits with status 1 if a round after the first at the
+ * default cap misses the pool, or has more than 1% of the minor faults of
+ * a round without it.
+ *
+ * -tilereport reads each image in 100 scanline tiles, merges their
+ * statistics in three shards through statistics files, as the tile modes
+ * of colortransfer do on separate machines, and transfers the next image
+ * a tile at a time with them. It exits with status 1 if the merged
+ * statistics are more than 1e-7 from the whole image's, or a tile differs
+ * from the same rows of a whole transfer.
+ *
+ * -incrementalreport edits each image in growing squares and times the
+ * updates of an IncrementalTransfer (incremental.h) against its first,
+ * whole transfer, with the difference from a whole transfer of the edited
+ * image. It exits with status 1 if an update is more than a level per
+ * channel from that, or re-applies only its tiles when the statistics have
+ * moved beyond the tolerance.
+ *
+ * -budgetreport runs budgeted transfers (budget.h) between the images at
+ * fractions of the time of the full quality tier, and prints the tier each
+ * budget gets with its estimated and actual time and loss. It exits with
+ * status 1 if a time is more than twice or less than half its estimate,
+ * the losses of all the transfers together are, or a transfer at the full
+ * budget differs from the full quality tier's. The losses of single images
+ * are only estimates for ranking the tiers (budget.h) and are not checked.
+ */
+
+#include "transfer.h"
+#include "imagefile.h"
+#include "fastmath.h"
+#include "moments.h"
+#include "histogram.h"
+#include "pool.h"
+#include "incremental.h"
+#include "budget.h"
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cmath>
+#include <chrono>
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <map>
+#include <algorithm>
+#include <dirent.h>
+#include <sys/resource.h>
+#include <unistd.h>
+
+using namespace std;
+
+struct BenchCase{
+  string name;
+  Pixel *source;
+  long nsource;
+  Pixel *dest;
+  long ndest;
+};
+
+struct Metrics{
+  double maxlab, meanlab;   // ΔE in lαβ against the reference
+  double maxrgb, meanrgb;   // ΔE in 8-bit RGB against the reference
+  double psnr;              // dB over the r, g and b channels, capped at 99
+  double mpps;              // destination megapixels per second
+};
+
+//
+// Thresholds for a kernel to pass against its baseline
+//
+const int UNIQUELEVELS = 1;    // a -unique kernel against its per-pixel twin, per channel
+double AccuracySlack = 0.10;   // allowed relative growth of each ΔE
+double PsnrSlack = 0.5;        // allowed PSNR drop in dB
+double SpeedSlack = 0.25;      // allowed relative throughput drop
+bool CheckSpeed = false;       // -speed, for baselines recorded on this machine
+
+static bool hasimageextension(const string &name){
+  const char *extensions[] = {".png", ".jpg", ".jpeg", ".tif", ".tiff", ".exr", ".bmp"};
+  size_t dot = name.rfind('.');
+  if(dot == string::npos)
+    return false;
+  string ext = name.substr(dot);
+  transform(ext.begin(), ext.end(), ext.begin(), ::tolower);
+  for(const char *e : extensions)
+    if(ext == e)
+      return true;
+  return false;
+}
+
+// the names of the images in imagedir, in name order
+static void imagenames(const string &imagedir, vector<string> &names){
+  DIR *dir = opendir(imagedir.c_str());
+  if(!dir){
+    cerr << "Could not open image directory " << imagedir << endl;
+    return;
+  }
+  for(struct dirent *entry = readdir(dir); entry; entry = readdir(dir))
+    if(hasimageextension(entry->d_name))
+      names.push_back(entry->d_name);
+  closedir(dir);
+  sort(names.begin(), names.end());
+}
+
+/*
+   Load every image in imagedir and pair each one, as destination, with the
+   next image in name order as source.
+*/
+static void imagecases(const string &imagedir, vector<BenchCase> &cases){
+  vector<string> names;
+  imagenames(imagedir, names);
+
+  vector<Pixel *> pixmaps(names.size());
+  vector<long> sizes(names.size());
+  for(size_t i = 0; i < names.size(); i++){
+    int width = 0, height = 0;
+    pixmaps[i] = readpixmap(imagedir + "/" + names[i], width, height);
+    sizes[i] = long(width) * height;
+  }
+
+  for(size_t i = 0; i < names.size(); i++){
+    size_t s = (i + 1) % names.size();
+    if(!pixmaps[i] || !pixmaps[s] || s == i)
+      continue;
+    BenchCase c = {names[i] + ":" + names[s], pixmaps[s], sizes[s], pixmaps[i], sizes[i]};
+    cases.push_back(c);
+  }
+}
+
+/*
+   Fill a width x height pixmap with one of the synthetic gradients:
+   an RGB ramp, a hue sweep, the hue sweep posterized into flat bands like
+   graphics or skies, or a dark ramp that sits on the 1/255 clamp.
+*/
+static Pixel *gradient(const string &kind, int width, int height){
+  Pixel *pixmap = poolnew<Pixel>(long(width) * height);
+  for(int row = 0; row < height; row++)
+    for(int col = 0; col < width; col++){
+      Pixel &p = pixmap[long(row) * width + col];
+      double u = double(col) / (width - 1), v = double(row) / (height - 1);
+      if(kind == "ramp"){
+        p.r = 255 * u;
+        p.g = 255 * v;
+        p.b = 255 * (1 - u) * (1 - v);
+      }
+      else if(kind == "hue" || kind == "bands"){
+        if(kind == "bands"){
+          u = floor(12 * u) / 12;
+          v = floor(8 * v) / 8;
+        }
+        double h = 6 * u, f = h - floor(h);
+        double value = 40 + 215 * v;
+        double rgb[6][3] = {{1, f, 0}, {1 - f, 1, 0}, {0, 1, f},
+                            {0, 1 - f, 1}, {f, 0, 1}, {1, 0, 1 - f}};
+        int sector = min(int(h), 5);
+        p.r = value * rgb[sector][0];
+        p.g = value * rgb[sector][1];
+        p.b = value * rgb[sector][2];
+      }
+      else{
+        p.r = 24 * u;
+        p.g = 24 * v;
+        p.b = 12 * (u + v);
+      }
+      p.a = 255;
+    }
+  return pixmap;
+}
+
+static void gradientcases(vector<BenchCase> &cases){
+  const int SIZE = 512;
+  const long n = long(SIZE) * SIZE;
+  Pixel *ramp = gradient("ramp", SIZE, SIZE);
+  Pixel *hue = gradient("hue", SIZE, SIZE);
+  Pixel *dark = gradient("dark", SIZE, SIZE);
+  Pixel *bands = gradient("bands", SIZE, SIZE);
+
+  BenchCase c1 = {"gradient-ramp:hue", hue, n, ramp, n};
+  BenchCase c2 = {"gradient-hue:ramp", ramp, n, hue, n};
+  BenchCase c3 = {"gradient-dark:ramp", ramp, n, dark, n};
+  BenchCase c4 = {"gradient-ramp:dark", dark, n, ramp, n};
+  BenchCase c5 = {"gradient-bands:hue", hue, n, bands, n};
+  BenchCase c6 = {"gradient-hue:bands", bands, n, hue, n};
+  cases.push_back(c1);
+  cases.push_back(c2);
+  cases.push_back(c3);
+  cases.push_back(c4);
+  cases.push_back(c5);
+  cases.push_back(c6);
+}
+
+// levels per channel of the posterized case, few enough for the palette path
+const int POSTERLEVELS = 6;
+
+/*
+   The first photograph case again with both images posterized to
+   POSTERLEVELS levels per channel, like graphics or scans of print, so
+   that the -unique kernels take their palette path on a photograph.
+*/
+static void posterizedcases(vector<BenchCase> &cases){
+  if(cases.empty())
+    return;
+  const BenchCase &photo = cases[0];
+  Pixel *posters[2] = {poolnew<Pixel>(photo.ndest), poolnew<Pixel>(photo.nsource)};
+  const Pixel *originals[2] = {photo.dest, photo.source};
+  long sizes[2] = {photo.ndest, photo.nsource};
+  for(int k = 0; k < 2; k++)
+    for(long i = 0; i < sizes[k]; i++){
+      Pixel p = originals[k][i];
+      unsigned char *channels[3] = {&p.r, &p.g, &p.b};
+      for(int c = 0; c < 3; c++){
+        int level = (*channels[c] * (POSTERLEVELS - 1) + 127) / 255;
+        *channels[c] = (unsigned char)(level * 255 / (POSTERLEVELS - 1));
+      }
+      posters[k][i] = p;
+    }
+  BenchCase c = {"posterized-" + photo.name, posters[1], sizes[1], posters[0], sizes[0]};
+  cases.push_back(c);
+}
+
+// Whether the -unique kernels keep n pixels as a palette rather than per pixel
+static bool takespalette(const Pixel *pixels, long n){
+  LabImage image;
+  ColorTransfer(findkernel("fast-unique")).convert(pixels, n, image);
+  return !image.indices.empty();
+}
+
+/*
+   Run a kernel through a ColorTransfer, statistics and apply, repeat times
+   and return the best time in seconds.
+*/
+static double timekernel(const TransferKernel *kernel, const BenchCase &c, Pixel *result, int repeat){
+  double best = 0;
+  for(int i = 0; i < repeat; i++){
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+    ColorTransfer transfer(kernel);
+    transfer.computestats(c.source, c.nsource, c.dest, c.ndest);
+    transfer.apply(c.dest, result, c.ndest);
+    double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    if(i == 0 || seconds < best)
+      best = seconds;
+  }
+  return best;
+}
+
+/*
+   Compare result with the reference output pixel by pixel.
+*/
+static void compare(const Pixel *reference, const Pixel *result, long n, Metrics &m){
+  double sumlab = 0, sumrgb = 0, sumsq = 0;
+  m.maxlab = m.maxrgb = 0;
+  for(long i = 0; i < n; i++){
+    double lab0[3], lab1[3];
+    referencelab(reference[i], lab0);
+    referencelab(result[i], lab1);
+    double dl = lab0[0] - lab1[0], da = lab0[1] - lab1[1], db = lab0[2] - lab1[2];
+    double delab = sqrt(dl * dl + da * da + db * db);
+
+    double dr = double(reference[i].r) - result[i].r;
+    double dg = double(reference[i].g) - result[i].g;
+    double dbl = double(reference[i].b) - result[i].b;
+    double sq = dr * dr + dg * dg + dbl * dbl;
+    double dergb = sqrt(sq);
+
+    sumlab += delab;
+    sumrgb += dergb;
+    sumsq += sq;
+    m.maxlab = max(m.maxlab, delab);
+    m.maxrgb = max(m.maxrgb, dergb);
+  }
+  m.meanlab = sumlab / n;
+  m.meanrgb = sumrgb / n;
+  double mse = sumsq / (3.0 * n);
+  m.psnr = mse > 0 ? min(10 * log10(255.0 * 255.0 / mse), 99.0) : 99.0;
+}
+
+// The most any channel of result differs from other, in levels
+static int maxlevels(const Pixel *other, const Pixel *result, long n){
+  int levels = 0;
+  for(long i = 0; i < n; i++)
+    levels = max(levels, max(abs(int(other[i].r) - result[i].r),
+                             max(abs(int(other[i].g) - result[i].g),
+                                 abs(int(other[i].b) - result[i].b))));
+  return levels;
+}
+
+static bool readbaselines(const string &filename, map<string, Metrics> &baselines){
+  ifstream in(filename.c_str());
+  if(!in)
+    return false;
+  string line;
+  while(getline(in, line)){
+    if(line.empty() || line[0] == '#')
+      continue;
+    istringstream fields(line);
+    string kernel, name;
+    Metrics m;
+    if(fields >> kernel >> name >> m.maxlab >> m.meanlab >> m.maxrgb >> m.meanrgb >> m.psnr >> m.mpps)
+      baselines[kernel + " " + name] = m;
+  }
+  return true;
+}
+
+static bool writebaselines(const string &filename, const vector<pair<string, Metrics> > &results){
+  FILE *out = fopen(filename.c_str(), "w");
+  if(!out){
+    cerr << "Could not write baselines to " << filename << endl;
+    return false;
+  }
+  fprintf(out, "# kernel case maxdE(lab) meandE(lab) maxdE(rgb) meandE(rgb) PSNR MP/s\n");
+  for(size_t i = 0; i < results.size(); i++){
+    const Metrics &m = results[i].second;
+    fprintf(out, "%s %.6g %.6g %.6g %.6g %.4f %.4f\n", results[i].first.c_str(),
+            m.maxlab, m.meanlab, m.maxrgb, m.meanrgb, m.psnr, m.mpps);
+  }
+  fclose(out);
+  return true;
+}
+
+static bool grew(double value, double base, double floor){
+  return value > base + max(base * AccuracySlack, floor);
+}
+
+/*
+   Return a description of how m drifted from its baseline, or "" if it is
+   within the thresholds.
+*/
+static string drift(const Metrics &m, const Metrics &base){
+  string why;
+  if(grew(m.maxlab, base.maxlab, 1e-4) || grew(m.meanlab, base.meanlab, 1e-5))
+    why += " lab";
+  if(grew(m.maxrgb, base.maxrgb, 0.01) || grew(m.meanrgb, base.meanrgb, 1e-3))
+    why += " rgb";
+  if(m.psnr < base.psnr - PsnrSlack)
+    why += " psnr";
+  if(CheckSpeed && m.mpps < base.mpps * (1 - SpeedSlack))
+    why += " speed";
+  return why;
+}
+
+//
+// The worst errors fastmath.h records for each precision, log10 absolute
+// and exp10 relative, which it rounds to two figures
+//
+struct MathBound{
+  double log10abs, exp10rel;
+};
+const MathBound LIBMBOUND = {1.4e-07, 6.0e-08};
+const MathBound LOWBOUND = {3.5e-06, 7.5e-05};
+const MathBound MEDIUMBOUND = {3.3e-07, 2.7e-06};
+const MathBound HIGHBOUND = {3.3e-07, 2.2e-07};
+const double MATHSLACK = 1.05;
+
+//
+// Error of one log10 or exp10 variant against double precision libm
+//
+struct MathError{
+  long points;
+  double maxabs, sumabs, maxrel;
+  MathError(): points(0), maxabs(0), sumabs(0), maxrel(0) {}
+  void add(double exact, double approx){
+    double abserr = fabs(approx - exact);
+    points++;
+    sumabs += abserr;
+    maxabs = max(maxabs, abserr);
+    maxrel = max(maxrel, abserr / fabs(exact));
+  }
+};
+
+// Print an error, and whether its worst is within bound, which is returned
+static bool printmatherror(const char *function, const char *precision,
+                           const char *domain, const MathError &e, double worst, double bound){
+  bool within = worst <= bound * MATHSLACK;
+  printf("%-6s %-8s %-22s %10ld %12.3g %12.3g %12.3g%s\n", function, precision, domain,
+         e.points, e.maxabs, e.sumabs / e.points, e.maxrel, within ? "" : "  FAIL");
+  return within;
+}
+
+/*
+   Exhaustive log10 error over the LMS values of all 2^24 RGB colors, both
+   as the kernels compute them, in float, and computed in double and
+   rounded to float, which lands on other floats and so on other errors;
+   and exp10 error over a dense sweep of [-5, 1], which covers every log
+   LMS value that does not saturate or vanish in 8-bit output. Returns
+   whether all are within their bounds.
+*/
+template<int P>
+static bool matherror(const char *name, bool libm, const MathBound &bound){
+  const double RGBTOLMS[3][3] = {{0.3811, 0.5783, 0.0402},
+                                 {0.1967, 0.7244, 0.0782},
+                                 {0.0241, 0.1288, 0.8444}};
+  const long SLICE = 256 * 256;
+  float *in = new float[3 * SLICE];
+  float *out = new float[3 * SLICE];
+
+  bool within = true;
+  for(int indouble = 0; indouble < 2; indouble++){
+    MathError logerror;
+    for(int r = 0; r < 256; r++){
+      long n = 3 * SLICE;
+      for(int g = 0; g < 256; g++)
+        for(int b = 0; b < 256; b++){
+          float rgb[3] = {max(float(r), 1.0f) / 255, max(float(g), 1.0f) / 255,
+                          max(float(b), 1.0f) / 255};
+          float *lms = &in[3 * (g * 256 + b)];
+          for(int row = 0; row < 3; row++)
+            if(indouble)
+              lms[row] = float(RGBTOLMS[row][0] * max(r, 1) / 255 +
+                               RGBTOLMS[row][1] * max(g, 1) / 255 +
+                               RGBTOLMS[row][2] * max(b, 1) / 255);
+            else
+              lms[row] = float(RGBTOLMS[row][0]) * rgb[0] + float(RGBTOLMS[row][1]) * rgb[1] +
+                         float(RGBTOLMS[row][2]) * rgb[2];
+        }
+      if(libm)
+        for(long i = 0; i < n; i++)
+          out[i] = log10f(in[i]);
+      else
+        fastlog10<P>(in, out, n);
+      for(long i = 0; i < n; i++)
+        logerror.add(log10(double(in[i])), out[i]);
+    }
+    within = printmatherror("log10", name, indouble ? "double LMS of 2^24 RGB" : "float LMS of 2^24 RGB",
+                            logerror, logerror.maxabs, bound.log10abs) && within;
+  }
+
+  MathError experror;
+  const long SWEEP = 1L << 24;
+  for(long start = 0; start < SWEEP; start += 3 * SLICE){
+    long n = min(3 * SLICE, SWEEP - start);
+    for(long i = 0; i < n; i++)
+      in[i] = -5.0 + 6.0 * double(start + i) / (SWEEP - 1);
+    if(libm)
+      for(long i = 0; i < n; i++)
+        out[i] = powf(10.0f, in[i]);
+    else
+      fastexp10<P>(in, out, n);
+    for(long i = 0; i < n; i++)
+      experror.add(pow(10.0, double(in[i])), out[i]);
+  }
+  within = printmatherror("exp10", name, "dense sweep [-5, 1]", experror, experror.maxrel,
+                          bound.exp10rel) && within;
+
+  delete[] in;
+  delete[] out;
+  return within;
+}
+
+// Returns whether every variant is within the bounds of fastmath.h
+static bool mathreport(){
+  printf("%-6s %-8s %-22s %10s %12s %12s %12s\n", "func", "variant", "domain",
+         "points", "max abs", "mean abs", "max rel");
+  bool within = matherror<FASTMATH_HIGH>("libm", true, LIBMBOUND);
+  within = matherror<FASTMATH_LOW>("low", false, LOWBOUND) && within;
+  within = matherror<FASTMATH_MEDIUM>("medium", false, MEDIUMBOUND) && within;
+  within = matherror<FASTMATH_HIGH>("high", false, HIGHBOUND) && within;
+  if(!within)
+    printf("Errors beyond the bounds recorded in fastmath.h\n");
+  return within;
+}
+
+/*
+   Synthetic lαβ of pixels first to first + n - 1: uniform noise about the
+   means of a dark image, which are large next to its spread, the hard case
+   for sums of squares. A pixel gets the same value however it is reached.
+*/
+static void syntheticlab(long first, long n, float *lab){
+  const float mean[3] = {-1.2f, 0.05f, -0.02f};
+  const float spread[3] = {0.3f, 0.04f, 0.03f};
+  for(long i = 0; i < n; i++){
+    uint64_t x = uint64_t(first + i) * 0x9e3779b97f4a7c15ULL;
+    x ^= x >> 29;
+    x *= 0xbf58476d1ce4e5b9ULL;
+    x ^= x >> 32;
+    for(int c = 0; c < 3; c++){
+      float u = float((x >> (21 * c)) & 0x1fffff) / 0x100000 - 1;
+      lab[3 * i + c] = mean[c] + spread[c] * u;
+    }
+  }
+}
+
+struct KahanSum{
+  double sum, carry;
+
+  KahanSum(): sum(0), carry(0) {}
+  void add(double x){
+    double y = x - carry;
+    double t = sum + y;
+    carry = (t - sum) - y;
+    sum = t;
+  }
+};
+
+//
+// The accumulations compared with the reference: LabMoments, LabMoments in
+// shards merged with mergestats, and sums of values and squares in double
+// and in float
+//
+struct SumMoments{
+  double sum[3], sq[3];
+  float fsum[3], fsq[3];
+
+  SumMoments() { for(int c = 0; c < 3; c++) sum[c] = sq[c] = fsum[c] = fsq[c] = 0; }
+};
+
+static void sumstats(double count, const double sum[3], const double sq[3], LabStats &stats){
+  stats.count = count;
+  for(int c = 0; c < 3; c++){
+    stats.mean[c] = sum[c] / count;
+    stats.m2[c] = max(sq[c] - sum[c] * stats.mean[c], 0.0);
+  }
+}
+
+//
+// The errors moments.h promises for LabMoments from MOMENTSPIXELS up, which
+// merged shards must also keep. Smaller images have fewer blocks for the
+// float rounding to average out over, and the bounds grow as
+// sqrt(MOMENTSPIXELS / pixels).
+//
+const double MOMENTSMEANERROR = 1e-11;
+const double MOMENTSSTDDEVERROR = 1e-10;   // relative
+const double MOMENTSPIXELS = 1e8;
+
+/*
+   Print the error of stats against the reference. With bounded the errors
+   must be within the bounds of moments.h; returns false if they are not.
+*/
+static bool printstatserror(long n, const char *method, const LabStats &stats,
+                            const LabStats &reference, double seconds, bool bounded){
+  double meanerr = 0, stddeverr = 0;
+  for(int c = 0; c < 3; c++){
+    meanerr = max(meanerr, fabs(stats.mean[c] - reference.mean[c]));
+    double sd = labstddev(reference, c);
+    stddeverr = max(stddeverr, fabs(labstddev(stats, c) - sd) / sd);
+  }
+  double scale = sqrt(max(MOMENTSPIXELS / n, 1.0));
+  bool within = !bounded || (meanerr <= MOMENTSMEANERROR * scale &&
+                             stddeverr <= MOMENTSSTDDEVERROR * scale);
+  printf("%8.3g %-14s %12.3g %12.3g %8.2f%s\n", n / 1e9, method, meanerr, stddeverr,
+         seconds > 0 ? n / 1e9 / seconds : 0.0, within ? "" : "  FAIL");
+  return within;
+}
+
+/*
+   Statistics of n synthetic pixels by each accumulation against a two-pass
+   compensated double reference, with the gigapixels per second of each
+   accumulation, not counting the making of the pixels. Returns false if
+   LabMoments, whole or in merged shards, is beyond the bounds of moments.h.
+*/
+static bool statserror(long n){
+  const long CHUNK = 1 << 16;
+  const int SHARDS = 16;
+  float *lab = new float[3 * CHUNK];
+
+  KahanSum refsum[3], refsq[3];
+  for(long start = 0; start < n; start += CHUNK){
+    long count = min(CHUNK, n - start);
+    syntheticlab(start, count, lab);
+    for(long i = 0; i < 3 * count; i++)
+      refsum[i % 3].add(lab[i]);
+  }
+  LabStats reference;
+  reference.count = double(n);
+  for(int c = 0; c < 3; c++)
+    reference.mean[c] = (refsum[c].sum - refsum[c].carry) / n;
+
+  LabMoments moments, shards[SHARDS];
+  SumMoments sums;
+  double seconds[4] = {0, 0, 0, 0};
+  for(long start = 0; start < n; start += CHUNK){
+    long count = min(CHUNK, n - start);
+    syntheticlab(start, count, lab);
+    for(long i = 0; i < 3 * count; i++){
+      double d = lab[i] - reference.mean[i % 3];
+      refsq[i % 3].add(d * d);
+    }
+
+    chrono::steady_clock::time_point t0 = chrono::steady_clock::now();
+    moments.add(lab, count);
+    chrono::steady_clock::time_point t1 = chrono::steady_clock::now();
+    shards[start / CHUNK * SHARDS / ((n + CHUNK - 1) / CHUNK)].add(lab, count);
+    chrono::steady_clock::time_point t2 = chrono::steady_clock::now();
+    for(long i = 0; i < 3 * count; i += 3)
+      for(int c = 0; c < 3; c++){
+        sums.sum[c] += lab[i + c];
+        sums.sq[c] += double(lab[i + c]) * lab[i + c];
+      }
+    chrono::steady_clock::time_point t3 = chrono::steady_clock::now();
+    for(long i = 0; i < 3 * count; i += 3)
+      for(int c = 0; c < 3; c++){
+        sums.fsum[c] += lab[i + c];
+        sums.fsq[c] += lab[i + c] * lab[i + c];
+      }
+    chrono::steady_clock::time_point t4 = chrono::steady_clock::now();
+
+    seconds[0] += chrono::duration<double>(t1 - t0).count();
+    seconds[1] += chrono::duration<double>(t2 - t1).count();
+    seconds[2] += chrono::duration<double>(t3 - t2).count();
+    seconds[3] += chrono::duration<double>(t4 - t3).count();
+  }
+  for(int c = 0; c < 3; c++)
+    reference.m2[c] = refsq[c].sum - refsq[c].carry;
+
+  LabStats merged = shards[0].stats();
+  for(int s = 1; s < SHARDS; s++)
+    mergestats(merged, shards[s].stats());
+  LabStats doublesums, floatsums;
+  sumstats(double(n), sums.sum, sums.sq, doublesums);
+  double fsum[3], fsq[3];
+  for(int c = 0; c < 3; c++){
+    fsum[c] = sums.fsum[c];
+    fsq[c] = sums.fsq[c];
+  }
+  sumstats(double(n), fsum, fsq, floatsums);
+
+  bool within = printstatserror(n, "LabMoments", moments.stats(), reference, seconds[0], true);
+  within = printstatserror(n, "16 shards", merged, reference, seconds[1], true) && within;
+  printstatserror(n, "double sums", doublesums, reference, seconds[2], false);
+  printstatserror(n, "float sums", floatsums, reference, seconds[3], false);
+
+  delete[] lab;
+  return within;
+}
+
+// Returns whether LabMoments kept its bounds at every size
+static bool statsreport(double gigapixels){
+  printf("%8s %-14s %12s %12s %8s\n", "GP", "accumulation", "mean err", "stddev rel", "GP/s");
+  bool within = true;
+  for(double scale = 0.01; scale <= 1; scale *= 10)
+    within = statserror(long(gigapixels * scale * 1e9)) && within;
+  if(!within)
+    printf("LabMoments beyond the bounds of moments.h\n");
+  return within;
+}
+
+/*
+   Decode time of every image in imagedir at full size and at each
+   reduction readreducedpixmap offers, with the error the reduction puts in
+   the fast kernel's statistics of the image and in a transfer from it, as
+   source, to the next image. The errors are against the full size decode;
+   scale 1 is libjpeg at full size.
+*/
+//
+// What a reduced decode may put in the statistics and a transfer of a large
+// photograph, of at least DECODELARGEPIXELS: measured on a 32 MP JPEG as
+// 0.2% on the deviations at 1/2, and 7% with 4 mean ΔE in RGB at 1/8, with
+// room for other photographs. Smaller images lose more of their texture.
+//
+const double DECODELARGEPIXELS = 16e6;
+const double DECODEHALFSTDDEV = 0.005;
+const double DECODEEIGHTHSTDDEV = 0.10;
+const double DECODEEIGHTHMEANRGB = 6;
+
+// Returns false if a full scale decode differs or a large image is beyond the bounds
+static bool decodereport(const string &imagedir, int repeat){
+  vector<string> names;
+  imagenames(imagedir, names);
+  const TransferKernel *kernel = findkernel("fast");
+  bool within = true, large = false;
+
+  printf("%-26s %5s %11s %9s %7s %10s %10s %9s %10s\n", "image", "scale", "size", "decode ms",
+         "speedup", "mean err", "stddev rel", "maxdE rgb", "meandE rgb");
+  for(size_t i = 0; i < names.size(); i++){
+    string file = imagedir + "/" + names[i];
+    string destfile = imagedir + "/" + names[(i + 1) % names.size()];
+    int width = 0, height = 0, destwidth = 0, destheight = 0;
+    double fullseconds = 0;
+    Pixel *full = NULL;
+    for(int r = 0; r < repeat; r++){
+      poolfree(full);
+      chrono::steady_clock::time_point start = chrono::steady_clock::now();
+      full = readpixmap(file, width, height);
+      double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+      fullseconds = r == 0 ? seconds : min(fullseconds, seconds);
+    }
+    Pixel *dest = readpixmap(destfile, destwidth, destheight);
+    if(!full || !dest){
+      poolfree(full);
+      poolfree(dest);
+      continue;
+    }
+    long ndest = long(destwidth) * destheight;
+    bool islarge = double(width) * height >= DECODELARGEPIXELS;
+    large = large || islarge;
+
+    LabStats fullstats, deststats;
+    kernel->stats(full, long(width) * height, fullstats);
+    kernel->stats(dest, ndest, deststats);
+    Pixel *reference = poolnew<Pixel>(ndest);
+    Pixel *result = poolnew<Pixel>(ndest);
+    ColorTransfer transfer(kernel);
+    transfer.setstats(fullstats, deststats);
+    transfer.apply(dest, reference, ndest);
+
+    for(int scale = 1; scale <= 8; scale *= 2){
+      int w = 0, h = 0, reduction = 0;
+      double seconds = 0;
+      Pixel *reduced = NULL;
+      for(int r = 0; r < repeat; r++){
+        poolfree(reduced);
+        chrono::steady_clock::time_point start = chrono::steady_clock::now();
+        reduced = readreducedpixmap(file, (width + scale - 1) / scale, (height + scale - 1) / scale,
+                                    w, h, reduction);
+        double s = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+        seconds = r == 0 ? s : min(seconds, s);
+      }
+      if(!reduced || reduction != scale || (scale == 1 && !(w == width && h == height))){
+        poolfree(reduced);
+        continue;
+      }
+
+      LabStats stats;
+      kernel->stats(reduced, long(w) * h, stats);
+      double meanerr = 0, stddeverr = 0;
+      for(int c = 0; c < 3; c++){
+        meanerr = max(meanerr, fabs(stats.mean[c] - fullstats.mean[c]));
+        stddeverr = max(stddeverr, fabs(labstddev(stats, c) / labstddev(fullstats, c) - 1));
+      }
+      transfer.setstats(stats, deststats);
+      transfer.apply(dest, result, ndest);
+      Metrics m;
+      compare(reference, result, ndest, m);
+
+      bool ok = true;
+      if(scale == 1)
+        ok = meanerr == 0 && stddeverr == 0 && m.maxrgb == 0;
+      else if(islarge && scale == 2)
+        ok = stddeverr <= DECODEHALFSTDDEV;
+      else if(islarge && scale == 8)
+        ok = stddeverr <= DECODEEIGHTHSTDDEV && m.meanrgb <= DECODEEIGHTHMEANRGB;
+      within = within && ok;
+
+      string size = to_string(w) + "x" + to_string(h);
+      printf("%-26s %5s %11s %9.2f %7.2f %10.3g %10.3g %9.4g %10.3g%s\n", names[i].c_str(),
+             ("1/" + to_string(scale)).c_str(), size.c_str(), seconds * 1e3,
+             fullseconds / seconds, meanerr, stddeverr, m.maxrgb, m.meanrgb, ok ? "" : "  FAIL");
+      poolfree(reduced);
+    }
+
+    poolfree(full);
+    poolfree(dest);
+    poolfree(reference);
+    poolfree(result);
+  }
+
+  if(!large)
+    printf("No image of %g MP or more, so only the full scale decodes were checked\n",
+           DECODELARGEPIXELS / 1e6);
+  if(!within)
+    printf("Decodes beyond the bounds\n");
+  return within;
+}
+
+/*
+   The distance between the distributions of channel c of two images without
+   a palette: the area between their cumulative histograms over the range of
+   both, in standard deviations of the second.
+*/
+static double distributiondistance(const LabImage &a, const LabImage &b, int c){
+  float low[3] = {HUGE_VALF, HUGE_VALF, HUGE_VALF};
+  float high[3] = {-HUGE_VALF, -HUGE_VALF, -HUGE_VALF};
+  labrange(a.lab.data(), long(a.lab.size() / 3), low, high);
+  labrange(b.lab.data(), long(b.lab.size() / 3), low, high);
+  LabHistogram ha(low, high), hb(low, high);
+  ha.add(a.lab.data(), long(a.lab.size() / 3));
+  hb.add(b.lab.data(), long(b.lab.size() / 3));
+
+  double cuma = 0, cumb = 0, area = 0;
+  for(int bin = 0; bin < HISTOGRAMBINS; bin++){
+    cuma += ha.bins[c][bin] / a.stats.count;
+    cumb += hb.bins[c][bin] / b.stats.count;
+    area += fabs(cuma - cumb);
+  }
+  return area * (high[c] - low[c]) / HISTOGRAMBINS / labstddev(b.stats, c);
+}
+
+//
+// What histogram matching must keep: at blend 0 it is the mean and deviation
+// transfer to within HISTOGRAMLEVELS per channel, and at blend 1 it brings
+// the distributions of every case closer to the source's than that transfer
+// does, and of all the cases, summed over channels, HISTOGRAMGAIN times
+// closer. The photographs gain 2 to 20 times and the gradients, with few
+// levels to spread, less than 2; 4.6 in all.
+//
+const int HISTOGRAMLEVELS = 1;
+const double HISTOGRAMGAIN = 3;
+
+/*
+   For each case, the time of a whole transfer from the converted
+   destination and its histogram, as for a batch, and how far the
+   distributions of the result are from the source's, with the mean and
+   deviation transfer and with histogram matching at blends 0, 0.5 and 1.
+   Returns false if matching does not keep the bounds above, or if the
+   destination histogram counted in pieces on several threads differs from
+   the one counted whole.
+*/
+static bool histogramreport(const string &imagedir, int repeat){
+  vector<BenchCase> cases;
+  imagecases(imagedir, cases);
+  gradientcases(cases);
+  const TransferKernel *kernel = findkernel("fast");
+  const double blends[] = {0, 0, 0.5, 1};   // of modes 1 to 3, after the plain transfer
+  bool within = true;
+  double plaindistance = 0, matcheddistance = 0;
+
+  printf("%-40s %-10s %9s %9s %9s %9s\n", "case", "mode", "ms", "dist l", "dist a", "dist b");
+  for(size_t i = 0; i < cases.size(); i++){
+    const BenchCase &c = cases[i];
+    ColorTransfer transfer(kernel);
+    LabImage destimage, sourceimage, resultimage;
+    transfer.convert(c.dest, c.ndest, destimage);
+    transfer.convert(c.source, c.nsource, sourceimage);
+    LabHistogram desthistogram = imagehistogram(destimage);
+    LabHistogram pieced = imagehistogram(destimage, 4, 1);
+    bool samecounts = true;
+    for(int channel = 0; channel < 3; channel++)
+      samecounts = samecounts && pieced.bins[channel] == desthistogram.bins[channel];
+    if(!samecounts){
+      printf("%-40s counted in pieces differs from whole  FAIL\n", c.name.c_str());
+      within = false;
+    }
+    Pixel *result = poolnew<Pixel>(c.ndest);
+    Pixel *plain = poolnew<Pixel>(c.ndest);
+    double casedistance = 0;   // of the mean and deviation transfer
+
+    for(int k = 0; k < 4; k++){
+      double seconds = 0;
+      for(int r = 0; r < repeat; r++){
+        chrono::steady_clock::time_point start = chrono::steady_clock::now();
+        if(k == 0){
+          transfer.computestats(c.source, c.nsource, destimage);
+          transfer.apply(destimage, result);
+        }
+        else{
+          LabImage source, matched;
+          transfer.convert(c.source, c.nsource, source);
+          histogrammatch(source, destimage, desthistogram, blends[k], matched);
+          transfer.setstats(matched.stats, matched.stats);
+          transfer.apply(matched, result);
+        }
+        double s = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+        seconds = r == 0 ? s : min(seconds, s);
+      }
+
+      transfer.convert(result, c.ndest, resultimage);
+      double distance[3];
+      for(int channel = 0; channel < 3; channel++)
+        distance[channel] = distributiondistance(resultimage, sourceimage, channel);
+      string status;
+      if(k == 0){
+        copy(result, result + c.ndest, plain);
+        casedistance = distance[0] + distance[1] + distance[2];
+        plaindistance += casedistance;
+      }
+      else if(k == 1){
+        int levels = maxlevels(plain, result, c.ndest);
+        if(levels > HISTOGRAMLEVELS){
+          status = "  FAIL: " + to_string(levels) + " levels from reinhard";
+          within = false;
+        }
+      }
+      else if(k == 3){
+        double sum = distance[0] + distance[1] + distance[2];
+        matcheddistance += sum;
+        if(sum >= casedistance){
+          status = "  FAIL: no closer than reinhard";
+          within = false;
+        }
+      }
+
+      string mode = k == 0 ? "reinhard" : "hist " + to_string(blends[k]).substr(0, 3);
+      printf("%-40s %-10s %9.2f %9.4f %9.4f %9.4f%s\n", c.name.c_str(), mode.c_str(), seconds * 1e3,
+             distance[0], distance[1], distance[2], status.c_str());
+    }
+    poolfree(result);
+    poolfree(plain);
+  }
+
+  printf("Matching at blend 1 brings the distributions %.1f times closer than reinhard\n",
+         plaindistance / matcheddistance);
+  if(matcheddistance * HISTOGRAMGAIN > plaindistance){
+    printf("Less than the %g times expected\n", HISTOGRAMGAIN);
+    within = false;
+  }
+  return within;
+}
+
+static long minorfaults(){
+  struct rusage usage;
+  getrusage(RUSAGE_SELF, &usage);
+  return usage.ru_minflt;
+}
+
+// the minor faults a round may have from the pool against one without it
+const double POOLFAULTS = 0.01;
+
+/*
+   Rounds of the transfers a batch does, each image the destination of the
+   next: read both, scale the source, convert the destination, take the
+   source statistics and apply into a new pixmap, then free everything. With
+   a cap of 0 every buffer goes back to the system when freed, as with
+   new and delete; at the default cap the rounds after the first must
+   take all their buffers from the pool, with at most POOLFAULTS of the
+   minor faults of a round without it. Returns false if they do not.
+*/
+static bool poolreport(const string &imagedir, int repeat){
+  vector<string> names;
+  imagenames(imagedir, names);
+  const TransferKernel *kernel = findkernel("fast");
+  const size_t caps[] = {0, POOLDEFAULTCAP};
+  bool within = true;
+  long uncappedfaults = 0;
+
+  printf("%8s %5s %9s %12s %8s %11s\n", "cap MB", "round", "ms", "minor faults", "hit rate",
+         "retained MB");
+  for(int k = 0; k < 2; k++){
+    bufferpool().setcap(caps[k]);
+    for(int r = 0; r < repeat; r++){
+      PoolStats before = bufferpool().stats();
+      long faults = minorfaults();
+      chrono::steady_clock::time_point start = chrono::steady_clock::now();
+      for(size_t i = 0; i < names.size(); i++){
+        int width, height, sourcewidth, sourceheight, scaledwidth, scaledheight;
+        Pixel *dest = readpixmap(imagedir + "/" + names[i], width, height);
+        Pixel *source = readpixmap(imagedir + "/" + names[(i + 1) % names.size()],
+                                   sourcewidth, sourceheight);
+        if(!dest || !source){
+          poolfree(dest);
+          poolfree(source);
+          continue;
+        }
+        Pixel *scaled = scalepixmap(source, sourcewidth, sourceheight, width, height,
+                                    scaledwidth, scaledheight);
+        long ndest = long(width) * height;
+        ColorTransfer transfer(kernel);
+        LabImage destimage;
+        transfer.convert(dest, ndest, destimage);
+        transfer.computestats(scaled, long(scaledwidth) * scaledheight, destimage);
+        Pixel *result = poolnew<Pixel>(ndest);
+        transfer.apply(destimage, result);
+        poolfree(result);
+        poolfree(scaled);
+        poolfree(source);
+        poolfree(dest);
+      }
+      double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+      PoolStats after = bufferpool().stats();
+      long requests = after.requests - before.requests;
+      faults = minorfaults() - faults;
+      if(k == 0)
+        uncappedfaults = max(uncappedfaults, faults);
+      bool ok = k == 0 || r == 0 ||
+                (after.hits - before.hits == requests && faults <= POOLFAULTS * uncappedfaults);
+      within = within && ok;
+      printf("%8zu %5d %9.2f %12ld %7.1f%% %11.1f%s\n", caps[k] >> 20, r + 1, seconds * 1e3,
+             faults, requests > 0 ? 100.0 * (after.hits - before.hits) / requests : 0.0,
+             after.retained / 1048576.0, ok ? "" : "  FAIL");
+    }
+  }
+
+  if(repeat < 2)
+    printf("One round, so the pool was not checked; give -repeat 2 or more\n");
+  if(!within)
+    printf("The pool missed or faulted after the first round\n");
+  return within;
+}
+
+// how far an update may be from a whole transfer, per channel
+const int INCREMENTALLEVELS = 1;
+
+/*
+   Each image is the destination of the next. Squares of it, centered and
+   growing, then its left half, are painted over with the source in turn,
+   and the IncrementalTransfer updated after each. The time of every update
+   is set against the first, whole transfer, and its result against a whole
+   transfer of the edited destination, which it may differ from by the
+   tolerance until a full re-apply. Returns false if an update is more than
+   INCREMENTALLEVELS per channel from that, or re-applies only some tiles
+   when the statistics have moved beyond the tolerance, or more pixels than
+   its tiles hold.
+*/
+
+static bool incrementalreport(const string &imagedir){
+  vector<string> names;
+  imagenames(imagedir, names);
+  const TransferKernel *kernel = findkernel("fast");
+  const int sizes[] = {16, 64, 256, 0};   // 0 for the left half
+  const long TILEPIXELS = long(INCREMENTALTILE) * INCREMENTALTILE;
+  bool within = true;
+
+  printf("%-26s %-9s %9s %6s %10s %4s %9s %9s %10s\n", "image", "edit", "ms", "tiles",
+         "pixels", "full", "shift", "maxdE rgb", "meandE rgb");
+  for(size_t i = 0; i < names.size(); i++){
+    int width, height, sourcewidth, sourceheight;
+    Pixel *dest = readpixmap(imagedir + "/" + names[i], width, height);
+    Pixel *source = readpixmap(imagedir + "/" + names[(i + 1) % names.size()],
+                               sourcewidth, sourceheight);
+    if(!dest || !source){
+      poolfree(dest);
+      poolfree(source);
+      continue;
+    }
+    long ndest = long(width) * height;
+    LabStats sourcestats;
+    kernel->stats(source, long(sourcewidth) * sourceheight, sourcestats);
+
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+    IncrementalTransfer incremental(kernel, sourcestats, dest, width, height);
+    double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    printf("%-26s %-9s %9.2f %6s %10ld %4s\n", names[i].c_str(), "whole", seconds * 1e3, "",
+           ndest, "");
+
+    Pixel *whole = poolnew<Pixel>(ndest);
+    for(int k = 0; k < 4; k++){
+      Rect r;
+      r.width = sizes[k] > 0 ? min(sizes[k], width) : width / 2;
+      r.height = sizes[k] > 0 ? min(sizes[k], height) : height;
+      r.x = sizes[k] > 0 ? (width - r.width) / 2 : 0;
+      r.y = sizes[k] > 0 ? (height - r.height) / 2 : 0;
+      for(int y = r.y; y < r.y + r.height; y++)
+        for(int x = r.x; x < r.x + r.width; x++)
+          dest[long(y) * width + x] = source[long(y % sourceheight) * sourcewidth + x % sourcewidth];
+
+      start = chrono::steady_clock::now();
+      IncrementalUpdate update = incremental.update(vector<Rect>(1, r));
+      seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+
+      LabStats deststats;
+      kernel->stats(dest, ndest, deststats);
+      ColorTransfer transfer(kernel);
+      transfer.setstats(sourcestats, deststats);
+      transfer.apply(dest, whole, ndest);
+      Metrics m;
+      compare(whole, incremental.result(), ndest, m);
+      bool ok = maxlevels(whole, incremental.result(), ndest) <= INCREMENTALLEVELS &&
+                (update.full || (update.shift <= INCREMENTALTOLERANCE &&
+                                 update.applied <= update.tiles * TILEPIXELS));
+      within = within && ok;
+
+      string edit = sizes[k] > 0 ? to_string(r.width) + "x" + to_string(r.height) : "half";
+      printf("%-26s %-9s %9.2f %6ld %10ld %4s %9.4f %9.4g %10.3g%s\n", names[i].c_str(),
+             edit.c_str(), seconds * 1e3, update.tiles, update.applied,
+             update.full ? "yes" : "no", update.shift, m.maxrgb, m.meanrgb, ok ? "" : "  FAIL");
+    }
+    poolfree(whole);
+    poolfree(dest);
+    poolfree(source);
+  }
+
+  if(!within)
+    printf("Updates beyond the tolerance or the tiles they touched\n");
+  return within;
+}
+
+//
+// The tile modes of colortransfer cut an image into bands of TILEROWS
+// scanlines. Their merged statistics must be within TILESTATSERROR of the
+// whole image's, the means in standard deviations and the deviations
+// relative, and the tiles must stitch back to the whole transfer exactly.
+// Tiles move the float blocks of LabMoments, so the statistics differ by
+// the float rounding of a block, 1e-9 to 2e-8 on the test images.
+//
+const int TILEROWS = 100;
+const int TILESHARDS = 3;
+const double TILESTATSERROR = 1e-7;
+
+/*
+   Each image is read a tile at a time with readscanlines, as -partial does,
+   and the statistics of the tiles merged in TILESHARDS shards, each through
+   a statistics file, as workers on separate machines would with -merge.
+   Each tile of the next image is then transferred from them, as
+   -applytiles does, against the same transfer of the whole image. Returns
+   false if the statistics or a tile are beyond the bounds above.
+*/
+static bool tilereport(const string &imagedir){
+  vector<string> names;
+  imagenames(imagedir, names);
+  const TransferKernel *kernel = findkernel("fast");
+  const char *tmpdir = getenv("TMPDIR");
+  string scratch = string(tmpdir ? tmpdir : "/tmp") + "/ctbench.XXXXXX";
+  int fd = mkstemp(&scratch[0]);
+  if(fd < 0){
+    cerr << "Could not make a scratch file in " << (tmpdir ? tmpdir : "/tmp") << endl;
+    return false;
+  }
+  close(fd);
+  bool within = true;
+
+  printf("%-26s %6s %12s %12s %12s\n", "image", "tiles", "mean err", "stddev rel", "tile dE rgb");
+  for(size_t i = 0; i < names.size(); i++){
+    string file = imagedir + "/" + names[i];
+    string destfile = imagedir + "/" + names[(i + 1) % names.size()];
+    int width, height, destwidth, destheight;
+    Pixel *whole = readpixmap(file, width, height);
+    Pixel *dest = readpixmap(destfile, destwidth, destheight);
+    if(!whole || !dest){
+      poolfree(whole);
+      poolfree(dest);
+      continue;
+    }
+    LabStats wholestats, deststats;
+    kernel->stats(whole, long(width) * height, wholestats);
+    kernel->stats(dest, long(destwidth) * destheight, deststats);
+
+    int tiles = (height + TILEROWS - 1) / TILEROWS;
+    LabStats merged = {0, {0, 0, 0}, {0, 0, 0}};
+    bool read = true;
+    for(int shard = 0; shard < TILESHARDS && read; shard++){
+      LabStats partial = {0, {0, 0, 0}, {0, 0, 0}};
+      for(int tile = shard * tiles / TILESHARDS; tile < (shard + 1) * tiles / TILESHARDS; tile++){
+        int tilewidth, rows, tileheight;
+        Pixel *pixels = readscanlines(file, tile * TILEROWS, TILEROWS, tilewidth, rows, tileheight);
+        if(!pixels){
+          read = false;
+          break;
+        }
+        LabStats part;
+        kernel->stats(pixels, long(tilewidth) * rows, part);
+        mergestats(partial, part);
+        poolfree(pixels);
+      }
+      string statskernel;
+      LabStats written;
+      read = read && writestatsfile(scratch, kernel->name, partial) &&
+             readstatsfile(scratch, statskernel, written);
+      if(read)
+        mergestats(merged, written);
+    }
+    if(!read){
+      cerr << "Could not read " << file << " in tiles" << endl;
+      within = false;
+      poolfree(whole);
+      poolfree(dest);
+      continue;
+    }
+
+    double meanerr = 0, stddeverr = 0;
+    for(int c = 0; c < 3; c++){
+      double sd = labstddev(wholestats, c);
+      meanerr = max(meanerr, fabs(merged.mean[c] - wholestats.mean[c]) / sd);
+      stddeverr = max(stddeverr, fabs(labstddev(merged, c) - sd) / sd);
+    }
+
+    // tile t holds rows t * TILEROWS on from the top, which are further up the bottom-up pixmap
+    ColorTransfer transfer(kernel);
+    transfer.setstats(merged, deststats);
+    long ndest = long(destwidth) * destheight;
+    Pixel *result = poolnew<Pixel>(ndest);
+    transfer.apply(dest, result, ndest);
+    double tilergb = 0;
+    for(int tile = 0; long(tile) * TILEROWS < destheight; tile++){
+      int tilewidth, rows, tileheight;
+      Pixel *pixels = readscanlines(destfile, tile * TILEROWS, TILEROWS, tilewidth, rows, tileheight);
+      if(!pixels){
+        tilergb = HUGE_VAL;
+        break;
+      }
+      long n = long(tilewidth) * rows;
+      transfer.apply(pixels, pixels, n);
+      Metrics m;
+      compare(result + long(destheight - tile * TILEROWS - rows) * destwidth, pixels, n, m);
+      tilergb = max(tilergb, m.maxrgb);
+      poolfree(pixels);
+    }
+
+    bool ok = meanerr <= TILESTATSERROR && stddeverr <= TILESTATSERROR && tilergb == 0;
+    within = within && ok;
+    printf("%-26s %6d %12.3g %12.3g %12.4g%s\n", names[i].c_str(), tiles, meanerr, stddeverr,
+           tilergb, ok ? "" : "  FAIL");
+    poolfree(result);
+    poolfree(whole);
+    poolfree(dest);
+  }
+  remove(scratch.c_str());
+
+  if(!within)
+    printf("Tiles beyond the bounds\n");
+  return within;
+}
+
+// how far the actual times, and the losses together, may be from the estimates
+const double BUDGETFACTOR = 2;
+
+/*
+   Each image is the destination of the next, at budgets of all, a half, a
+   quarter and an eighth of the estimated time of the full quality tier.
+   The times include reading the images and writing the result to a
+   scratch PNG file next to the host's cost file, as -budget does; the
+   loss is the mean ΔE in RGB against the full quality tier's result.
+   Returns false if a time is more than BUDGETFACTOR from its estimate,
+   the losses of all the transfers together are, or a transfer at the
+   full budget differs from the full quality tier's.
+*/
+static bool budgetreport(const string &imagedir){
+  vector<string> names;
+  imagenames(imagedir, names);
+  Tuning tuning = hosttuning(false);
+  CostModel costs = hostcosts(tuning, false);
+  string scratch = costfile() + ".budgetreport.png";
+  const double fractions[] = {1, 0.5, 0.25, 0.125};
+  bool within = true;
+  double estimatedloss = 0, loss = 0;
+
+  printf("%-26s %9s %6s %-10s %6s %6s %9s %9s %8s %8s\n", "image", "budget ms", "tier",
+         "kernel", "reduce", "stride", "est ms", "ms", "est dE", "dE");
+  for(size_t i = 0; i < names.size(); i++){
+    string destfile = imagedir + "/" + names[i];
+    string sourcefile = imagedir + "/" + names[(i + 1) % names.size()];
+    int sourcewidth, sourceheight, destwidth, destheight;
+    if(!readimagesize(sourcefile, sourcewidth, sourceheight) ||
+       !readimagesize(destfile, destwidth, destheight))
+      continue;
+    BudgetTier best = choosetier(costs, HUGE_VAL, sourcewidth, sourceheight, isjpeg(sourcefile),
+                                 destwidth, destheight, isjpeg(destfile));
+    int width, height, reduction;
+    Pixel *full = tiertransfer(tuning, best, sourcefile, destfile, width, height, reduction);
+    if(!full)
+      continue;
+
+    for(int f = 0; f < 4; f++){
+      double budgetms = best.ms * fractions[f];
+      chrono::steady_clock::time_point start = chrono::steady_clock::now();
+      BudgetTier tier = choosetier(costs, budgetms, sourcewidth, sourceheight, isjpeg(sourcefile),
+                                   destwidth, destheight, isjpeg(destfile));
+      Pixel *result = tiertransfer(tuning, tier, sourcefile, destfile, width, height, reduction);
+      if(!result)
+        continue;
+      writepixmap(scratch, result, width, height);
+      double ms = chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+
+      Metrics m;
+      compare(full, result, long(width) * height, m);
+      estimatedloss += tier.loss;
+      loss += m.meanrgb;
+      bool ok = ms <= tier.ms * BUDGETFACTOR && ms >= tier.ms / BUDGETFACTOR &&
+                (f > 0 || m.maxrgb == 0);
+      within = within && ok;
+      printf("%-26s %9.1f %6d %-10s %6d %6d %9.1f %9.1f %8.3f %8.3f%s%s\n", names[i].c_str(),
+             budgetms, tier.level, tier.kernel->name, reduction, tier.stride, tier.ms, ms,
+             tier.loss, m.meanrgb, tier.fits ? "" : "  (none fits)", ok ? "" : "  FAIL");
+      poolfree(result);
+    }
+    poolfree(full);
+  }
+  remove(scratch.c_str());
+
+  printf("Mean dE in RGB summed over the transfers %.3f, estimated %.3f\n", loss, estimatedloss);
+  if(loss > estimatedloss * BUDGETFACTOR || loss < estimatedloss / BUDGETFACTOR){
+    printf("The losses are more than %g times from their estimates\n", BUDGETFACTOR);
+    within = false;
+  }
+  return within;
+}
+
+static void usage(){
+  cerr << "usage: ctbench [-update] [-baselines file] [-accuracy frac] [-psnr dB]" << endl;
+  cerr << "               [-speed] [-slowdown frac] [-repeat n] [imagedir]" << endl;
+  cerr << "       ctbench -mathreport" << endl;
+  cerr << "       ctbench -statsreport [gigapixels]" << endl;
+  cerr << "       ctbench -decodereport [-repeat n] [imagedir]" << endl;
+  cerr << "       ctbench -histogramreport [-repeat n] [imagedir]" << endl;
+  cerr << "       ctbench -poolreport [-repeat n] [imagedir]" << endl;
+  cerr << "       ctbench -tilereport [imagedir]" << endl;
+  cerr << "       ctbench -incrementalreport [imagedir]" << endl;
+  cerr << "       ctbench -budgetreport [imagedir]" << endl;
+  exit(2);
+}
+
+int main(int argc, char *argv[]){
+  string imagedir = "images";
+  string baselinefile = "ctbench.baselines";
+  bool update = false, decode = false, histogram = false, pool = false;
+  bool incremental = false, budget = false, tiles = false;
+  int repeat = 3;
+
+  for(int i = 1; i < argc; i++){
+    string arg = argv[i];
+    bool hasvalue = i + 1 < argc;
+    if(arg == "-mathreport")
+      return mathreport() ? 0 : 1;
+    else if(arg == "-statsreport"){
+      // the hundredth of the size must still be a thousand pixels or so
+      double gigapixels = 1;
+      char *end = NULL;
+      if(hasvalue)
+        gigapixels = strtod(argv[i + 1], &end);
+      if(hasvalue && (*end != '\0' || !(gigapixels >= 1e-4))){
+        cerr << "-statsreport takes a number of gigapixels of at least 1e-4" << endl;
+        usage();
+      }
+      return statsreport(gigapixels) ? 0 : 1;
+    }
+    else if(arg == "-update")
+      update = true;
+    else if(arg == "-decodereport")
+      decode = true;
+    else if(arg == "-histogramreport")
+      histogram = true;
+    else if(arg == "-poolreport")
+      pool = true;
+    else if(arg == "-tilereport")
+      tiles = true;
+    else if(arg == "-incrementalreport")
+      incremental = true;
+    else if(arg == "-budgetreport")
+      budget = true;
+    else if(arg == "-speed")
+      CheckSpeed = true;
+    else if(arg == "-baselines" && hasvalue)
+      baselinefile = argv[++i];
+    else if(arg == "-accuracy" && hasvalue)
+      AccuracySlack = atof(argv[++i]);
+    else if(arg == "-psnr" && hasvalue)
+      PsnrSlack = atof(argv[++i]);
+    else if(arg == "-slowdown" && hasvalue)
+      SpeedSlack = atof(argv[++i]);
+    else if(arg == "-repeat" && hasvalue)
+      repeat = max(atoi(argv[++i]), 1);
+    else if(arg[0] == '-')
+      usage();
+    else
+      imagedir = arg;
+  }
+
+  if(decode)
+    return decodereport(imagedir, repeat) ? 0 : 1;
+  if(histogram)
+    return histogramreport(imagedir, repeat) ? 0 : 1;
+  if(pool)
+    return poolreport(imagedir, repeat) ? 0 : 1;
+  if(tiles)
+    return tilereport(imagedir) ? 0 : 1;
+  if(incremental)
+    return incrementalreport(imagedir) ? 0 : 1;
+  if(budget)
+    return budgetreport(imagedir) ? 0 : 1;
+
+  vector<BenchCase> cases;
+  imagecases(imagedir, cases);
+  posterizedcases(cases);
+  gradientcases(cases);
+
+  map<string, Metrics> baselines;
+  bool havebaselines = !update && readbaselines(baselinefile, baselines);
+  if(!update && !havebaselines)
+    cerr << "No baselines in " << baselinefile << ", run with -update to record them" << endl;
+
+  vector<pair<string, Metrics> > results;
+  int failures = 0;
+
+  printf("%-40s %-10s %10s %10s %10s %10s %7s %8s\n", "case", "kernel",
+         "maxdE lab", "meandE lab", "maxdE rgb", "meandE rgb", "PSNR", "MP/s");
+
+  for(size_t i = 0; i < cases.size(); i++){
+    const BenchCase &c = cases[i];
+    if(c.name.compare(0, 11, "posterized-") == 0 &&
+       (!takespalette(c.source, c.nsource) || !takespalette(c.dest, c.ndest))){
+      printf("%-40s falls back to the per-pixel loop  FAIL\n", c.name.c_str());
+      failures++;
+    }
+    Pixel *reference = poolnew<Pixel>(c.ndest);
+    Pixel *result = poolnew<Pixel>(c.ndest);
+    referencetransfer(c.source, c.nsource, c.dest, reference, c.ndest);
+    map<string, Pixel *> perpixel;   // results of the kernels that have -unique twins
+
+    // the reference kernel in stages first, which must match referencetransfer exactly
+    for(int k = -1; k < ntransferkernels; k++){
+      const TransferKernel *kernel = k < 0 ? findkernel("reference") : &transferkernels[k];
+      const char *name = kernel->name;
+
+      Metrics m;
+      double seconds = timekernel(kernel, c, result, repeat);
+      m.mpps = c.ndest / 1e6 / seconds;
+      compare(reference, result, c.ndest, m);
+
+      string key = string(name) + " " + c.name;
+      results.push_back(make_pair(key, m));
+
+      // a -unique kernel runs after its per-pixel twin, whose result is kept
+      string twin = name, suffix = "-unique";
+      int levels = 0;
+      if(twin.size() > suffix.size() &&
+         twin.compare(twin.size() - suffix.size(), suffix.size(), suffix) == 0){
+        twin.erase(twin.size() - suffix.size());
+        if(perpixel.count(twin))
+          levels = maxlevels(perpixel[twin], result, c.ndest);
+      }
+      else if(findkernel(string(name) + suffix)){
+        perpixel[name] = poolnew<Pixel>(c.ndest);
+        copy(result, result + c.ndest, perpixel[name]);
+      }
+
+      string status;
+      map<string, Metrics>::const_iterator base = baselines.find(key);
+      if(k < 0 && m.maxrgb != 0){
+        status = "  MISMATCH: differs from referencetransfer";
+        failures++;
+      }
+      else if(levels > UNIQUELEVELS){
+        status = "  MISMATCH: " + to_string(levels) + " levels from " + twin;
+        failures++;
+      }
+      else if(base != baselines.end()){
+        string why = drift(m, base->second);
+        if(!why.empty()){
+          status = "  DRIFT:" + why;
+          failures++;
+        }
+      }
+      else if(havebaselines)
+        status = "  (no baseline)";
+
+      printf("%-40s %-10s %10.4g %10.3g %10.4g %10.3g %7.2f %8.2f%s\n", c.name.c_str(), name,
+             m.maxlab, m.meanlab, m.maxrgb, m.meanrgb, m.psnr, m.mpps, status.c_str());
+    }
+
+    for(map<string, Pixel *>::iterator p = perpixel.begin(); p != perpixel.end(); ++p)
+      poolfree(p->second);
+    poolfree(reference);
+    poolfree(result);
+  }
+
+  // a staged reference that has drifted from referencetransfer is never recorded
+  if(update && failures == 0){
+    if(!writebaselines(baselinefile, results))
+      return 1;
+    printf("Baselines written to %s\n", baselinefile.c_str());
+    return 0;
+  }
+
+  if(failures > 0){
+    printf("%d kernel runs drifted beyond the thresholds or mismatched\n", failures);
+    return 1;
+  }
+  return havebaselines ? 0 : 1;
+}
@@ -0,0 +1,219 @@
+/*
+*   Fast log10 and exp10 for the color transfer kernels
+*
+*   log10 splits x into 2^e * m with m in [sqrt(1/2), sqrt(2)) by integer
+*   arithmetic on the float bits, then evaluates an odd minimax polynomial
+*   in t = (m - 1) / (m + 1). exp10 reduces x to n * log10(2) + r with
+*   |r| <= log10(2) / 2, evaluates a minimax polynomial for 10^r and scales
+*   it by 2^n through the exponent bits.
+*
+*   The precision is a template parameter. Code that does not care uses
+*   FASTMATH_PRECISION, which can be set at compile time, and the array
+*   forms also take it at run time. Worst errors over the inputs the
+*   transfer produces (for log10 the LMS of all 2^24 RGB colors, computed
+*   in float as the kernels do and in double rounded to float, which is
+*   the worse at high; a dense sweep of [-5, 1] for exp10), as printed by
+*   ctbench -mathreport:
+*
+*     precision   log10 terms  max abs error   exp10 degree  max rel error
+*     low         2            3.5e-06         3             7.5e-05
+*     medium      3            3.3e-07         4             2.7e-06
+*     high        4            3.3e-07         5             2.2e-07
+*     libm float  -            1.4e-07         -             6.0e-08
+*
+*   At medium and high the log10 error is float rounding of the result, as
+*   it is for libm, rather than the polynomial.
+*
+*   log10 is only valid for positive normal floats. exp10 clamps its
+*   argument to [-37, 38] so that the result stays a normal float.
+*/
+
+#ifndef FASTMATH_H
+#define FASTMATH_H
+
+#include <cstring>
+#include <cmath>
+#include <algorithm>
+#include <stdint.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+enum MathPrecision { FASTMATH_LOW, FASTMATH_MEDIUM, FASTMATH_HIGH };
+
+#ifndef FASTMATH_PRECISION
+#define FASTMATH_PRECISION FASTMATH_MEDIUM
+#endif
+
+//
+// Polynomial coefficients, lowest order first. LOG is r(t^2) with
+// log10(m) = t * r(t^2); EXP approximates 10^r.
+//
+template<int P> struct FastMathTable;
+
+template<> struct FastMathTable<FASTMATH_LOW>{
+  enum { LOGTERMS = 2, EXPTERMS = 4 };
+  static const float *log(){
+    static const float c[LOGTERMS] = {0.868569633f, 0.294746917f};
+    return c;
+  }
+  static const float *exp(){
+    static const float c[EXPTERMS] = {0.999928074f, 2.30296314f, 2.67726378f, 2.02249197f};
+    return c;
+  }
+};
+
+template<> struct FastMathTable<FASTMATH_MEDIUM>{
+  enum { LOGTERMS = 3, EXPTERMS = 5 };
+  static const float *log(){
+    static const float c[LOGTERMS] = {0.868589067f, 0.289466930f, 0.179347869f};
+    return c;
+  }
+  static const float *exp(){
+    static const float c[EXPTERMS] = {0.999999261f, 2.30250083f, 2.65118015f,
+                                      2.04984597f, 1.16540660f};
+    return c;
+  }
+};
+
+template<> struct FastMathTable<FASTMATH_HIGH>{
+  enum { LOGTERMS = 4, EXPTERMS = 6 };
+  static const float *log(){
+    static const float c[LOGTERMS] = {0.868588963f, 0.289530303f, 0.173608329f, 0.129965450f};
+    return c;
+  }
+  static const float *exp(){
+    static const float c[EXPTERMS] = {1.00000007f, 2.30258438f, 2.65089046f,
+                                      2.03478945f, 1.17824657f, 0.537073620f};
+    return c;
+  }
+};
+
+const int32_t FASTMATH_SQRTHALF = 0x3f3504f3;   // bits of sqrt(1/2)
+const float FASTMATH_LOG10_2 = 0.30103001f;
+const float FASTMATH_LOG10_2_HI = 0.301025391f; // n * HI is exact for |n| < 2^12
+const float FASTMATH_LOG10_2_LO = 4.60503907e-06f;
+const float FASTMATH_LOG2_10 = 3.32192802f;
+
+template<int P>
+inline float fastlog10(float x){
+  int32_t bits;
+  memcpy(&bits, &x, sizeof(bits));
+  int32_t offset = bits - FASTMATH_SQRTHALF;
+  int32_t e = offset >> 23;
+  int32_t mbits = (offset & 0x007fffff) + FASTMATH_SQRTHALF;
+  float m;
+  memcpy(&m, &mbits, sizeof(m));
+
+  float t = (m - 1) / (m + 1);
+  float s = t * t;
+  const float *c = FastMathTable<P>::log();
+  float r = c[FastMathTable<P>::LOGTERMS - 1];
+  for(int i = FastMathTable<P>::LOGTERMS - 2; i >= 0; i--)
+    r = r * s + c[i];
+  return t * r + float(e) * FASTMATH_LOG10_2;
+}
+
+template<int P>
+inline float fastexp10(float x){
+  x = std::min(std::max(x, -37.0f), 38.0f);
+  float n = floorf(x * FASTMATH_LOG2_10 + 0.5f);
+  float r = (x - n * FASTMATH_LOG10_2_HI) - n * FASTMATH_LOG10_2_LO;
+
+  const float *c = FastMathTable<P>::exp();
+  float p = c[FastMathTable<P>::EXPTERMS - 1];
+  for(int i = FastMathTable<P>::EXPTERMS - 2; i >= 0; i--)
+    p = p * r + c[i];
+
+  int32_t bits = (int32_t(n) + 127) << 23;
+  float scale;
+  memcpy(&scale, &bits, sizeof(scale));
+  return p * scale;
+}
+
+inline float fastlog10(float x) { return fastlog10<FASTMATH_PRECISION>(x); }
+inline float fastexp10(float x) { return fastexp10<FASTMATH_PRECISION>(x); }
+
+#ifdef __SSE2__
+//
+// Four-wide forms of the same approximations
+//
+template<int P>
+inline __m128 fastlog10(__m128 x){
+  const __m128i sqrthalf = _mm_set1_epi32(FASTMATH_SQRTHALF);
+  __m128i offset = _mm_sub_epi32(_mm_castps_si128(x), sqrthalf);
+  __m128i e = _mm_srai_epi32(offset, 23);
+  __m128i mbits = _mm_add_epi32(_mm_and_si128(offset, _mm_set1_epi32(0x007fffff)), sqrthalf);
+  __m128 m = _mm_castsi128_ps(mbits);
+
+  const __m128 one = _mm_set1_ps(1.0f);
+  __m128 t = _mm_div_ps(_mm_sub_ps(m, one), _mm_add_ps(m, one));
+  __m128 s = _mm_mul_ps(t, t);
+  const float *c = FastMathTable<P>::log();
+  __m128 r = _mm_set1_ps(c[FastMathTable<P>::LOGTERMS - 1]);
+  for(int i = FastMathTable<P>::LOGTERMS - 2; i >= 0; i--)
+    r = _mm_add_ps(_mm_mul_ps(r, s), _mm_set1_ps(c[i]));
+  return _mm_add_ps(_mm_mul_ps(t, r),
+                    _mm_mul_ps(_mm_cvtepi32_ps(e), _mm_set1_ps(FASTMATH_LOG10_2)));
+}
+
+template<int P>
+inline __m128 fastexp10(__m128 x){
+  x = _mm_min_ps(_mm_max_ps(x, _mm_set1_ps(-37.0f)), _mm_set1_ps(38.0f));
+  __m128i ni = _mm_cvtps_epi32(_mm_mul_ps(x, _mm_set1_ps(FASTMATH_LOG2_10)));
+  __m128 n = _mm_cvtepi32_ps(ni);
+  __m128 r = _mm_sub_ps(_mm_sub_ps(x, _mm_mul_ps(n, _mm_set1_ps(FASTMATH_LOG10_2_HI))),
+                        _mm_mul_ps(n, _mm_set1_ps(FASTMATH_LOG10_2_LO)));
+
+  const float *c = FastMathTable<P>::exp();
+  __m128 p = _mm_set1_ps(c[FastMathTable<P>::EXPTERMS - 1]);
+  for(int i = FastMathTable<P>::EXPTERMS - 2; i >= 0; i--)
+    p = _mm_add_ps(_mm_mul_ps(p, r), _mm_set1_ps(c[i]));
+
+  __m128i bits = _mm_slli_epi32(_mm_add_epi32(ni, _mm_set1_epi32(127)), 23);
+  return _mm_mul_ps(p, _mm_castsi128_ps(bits));
+}
+#endif
+
+//
+// Array forms: out[i] = f(in[i]) for n values. in and out may be the same.
+//
+template<int P>
+inline void fastlog10(const float *in, float *out, long n){
+  long i = 0;
+#ifdef __SSE2__
+  for(long end = n & ~3L; i < end; i += 4)
+    _mm_storeu_ps(out + i, fastlog10<P>(_mm_loadu_ps(in + i)));
+#endif
+  for(; i < n; i++)
+    out[i] = fastlog10<P>(in[i]);
+}
+
+template<int P>
+inline void fastexp10(const float *in, float *out, long n){
+  long i = 0;
+#ifdef __SSE2__
+  for(long end = n & ~3L; i < end; i += 4)
+    _mm_storeu_ps(out + i, fastexp10<P>(_mm_loadu_ps(in + i)));
+#endif
+  for(; i < n; i++)
+    out[i] = fastexp10<P>(in[i]);
+}
+
+inline void fastlog10(const float *in, float *out, long n, MathPrecision precision){
+  switch(precision){
+    case FASTMATH_LOW: fastlog10<FASTMATH_LOW>(in, out, n); break;
+    case FASTMATH_MEDIUM: fastlog10<FASTMATH_MEDIUM>(in, out, n); break;
+    default: fastlog10<FASTMATH_HIGH>(in, out, n); break;
+  }
+}
+
+inline void fastexp10(const float *in, float *out, long n, MathPrecision precision){
+  switch(precision){
+    case FASTMATH_LOW: fastexp10<FASTMATH_LOW>(in, out, n); break;
+    case FASTMATH_MEDIUM: fastexp10<FASTMATH_MEDIUM>(in, out, n); break;
+    default: fastexp10<FASTMATH_HIGH>(in, out, n); break;
+  }
+}
+
+#endif
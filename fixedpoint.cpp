@@ -0,0 +1,132 @@
+/*
+*   Fixed-point lαβ conversion for 8-bit images
+*/
+
+#include "fixedpoint.h"
+
+#include <cmath>
+#include <cstdlib>
+#include <algorithm>
+
+using namespace std;
+
+const int TABLEBITS = 12;
+const int TABLESIZE = 1 << TABLEBITS;
+
+const int32_t LOG10_2 = 5050445;      // log10(2) in Q24
+const int32_t LOGSCALE = 121182169;   // log10(255 * 2^16) in Q24
+const int64_t LOG2_10 = 55732705;     // log2(10) in Q24
+
+// exponents of two the inverse log is clamped to, so that RGB fits in 64 bits
+const int MINEXPONENT = -40;
+const int MAXEXPONENT = 8;
+
+struct FixedTables{
+  uint16_t rgbtolms[3][3];          // Q16
+  int16_t lmstolab[3][3];           // Q14
+  int16_t labtolms[3][3];           // Q14
+  int16_t lmstorgb[3][3];           // Q12
+  int32_t logmantissa[TABLESIZE];   // log10(1 + (i + 1/2) / TABLESIZE) in Q24
+  int32_t expfraction[TABLESIZE];   // 2^((i + 1/2) / TABLESIZE) in Q30
+
+  FixedTables();
+};
+
+FixedTables::FixedTables(){
+  double tolab[3][3] = {{1 / sqrt(3), 1 / sqrt(3), 1 / sqrt(3)},
+                        {1 / sqrt(6), 1 / sqrt(6), -2 / sqrt(6)},
+                        {1 / sqrt(2), -1 / sqrt(2), 0}};
+  double tolms[3][3] = {{sqrt(3) / 3, sqrt(6) / 6, sqrt(2) / 2},
+                        {sqrt(3) / 3, sqrt(6) / 6, -sqrt(2) / 2},
+                        {sqrt(3) / 3, -2 * sqrt(6) / 6, 0}};
+
+  for(int row = 0; row < 3; row++)
+    for(int col = 0; col < 3; col++){
+      rgbtolms[row][col] = uint16_t(lrint(RGBTOLMS[row][col] * 65536));
+      lmstolab[row][col] = int16_t(lrint(tolab[row][col] * 16384));
+      labtolms[row][col] = int16_t(lrint(tolms[row][col] * 16384));
+      lmstorgb[row][col] = int16_t(lrint(LMSTORGB[row][col] * 4096));
+    }
+
+  for(int i = 0; i < TABLESIZE; i++){
+    double x = (i + 0.5) / TABLESIZE;
+    logmantissa[i] = int32_t(lrint(log10(1 + x) * (1 << 24)));
+    expfraction[i] = int32_t(lrint(pow(2.0, x) * (1 << 30)));
+  }
+}
+
+// built on first use; the initialization of a local static is thread-safe
+static const FixedTables &fixedtables(){
+  static const FixedTables tables;
+  return tables;
+}
+
+FixedPipeline::FixedPipeline(): t(fixedtables()){
+}
+
+/*
+   log10 of x / (255 * 2^16) in Q16, for the integer LMS of a color: the
+   exponent of x plus the table entry for the 12 bits below its leading one.
+*/
+static inline int32_t fixedlog10(uint32_t x, const FixedTables &t){
+  int e = 31 - __builtin_clz(x);
+  uint32_t m = e >= TABLEBITS ? x >> (e - TABLEBITS) : x << (TABLEBITS - e);
+  int32_t log = e * LOG10_2 + t.logmantissa[m & (TABLESIZE - 1)] - LOGSCALE;
+  return (log + 128) >> 8;
+}
+
+/*
+   2^y for y in Q16, in Q30 and 64 bits.
+*/
+static inline int64_t fixedexp2(int64_t y, const FixedTables &t){
+  y = min(max(y, int64_t(MINEXPONENT) * 65536), int64_t(MAXEXPONENT) * 65536 - 1);
+  int n = int(y >> 16);
+  int64_t p = t.expfraction[(y >> (16 - TABLEBITS)) & (TABLESIZE - 1)];
+  return n >= 0 ? p << n : p >> -n;
+}
+
+void FixedPipeline::lab(const Pixel *pixels, int n, float *lab) const{
+  for(int i = 0; i < n; i++){
+    uint32_t rgb[3] = {max(pixels[i].r, (unsigned char)1), max(pixels[i].g, (unsigned char)1),
+                       max(pixels[i].b, (unsigned char)1)};
+    int32_t lms[3];
+    for(int row = 0; row < 3; row++)
+      lms[row] = fixedlog10(t.rgbtolms[row][0] * rgb[0] + t.rgbtolms[row][1] * rgb[1] +
+                            t.rgbtolms[row][2] * rgb[2], t);
+    for(int row = 0; row < 3; row++){
+      int64_t sum = int64_t(t.lmstolab[row][0]) * lms[0] + int64_t(t.lmstolab[row][1]) * lms[1] +
+                    int64_t(t.lmstolab[row][2]) * lms[2];
+      lab[3 * i + row] = float((sum + (1 << 13)) >> 14) / 65536;
+    }
+  }
+}
+
+void FixedPipeline::apply(const float *lab, int n, const float scale[3], const float offset[3],
+                          Pixel *result) const{
+  int64_t fixedscale[3], fixedoffset[3];
+  for(int c = 0; c < 3; c++){
+    fixedscale[c] = llrint(double(scale[c]) * 65536);
+    fixedoffset[c] = llrint(double(offset[c]) * 65536);
+  }
+
+  for(int i = 0; i < n; i++){
+    int64_t moved[3];
+    for(int c = 0; c < 3; c++)
+      moved[c] = ((llrint(double(lab[3 * i + c]) * 65536) * fixedscale[c] + (1 << 15)) >> 16) +
+                 fixedoffset[c];
+
+    int64_t lms[3];
+    for(int row = 0; row < 3; row++){
+      int64_t log = (t.labtolms[row][0] * moved[0] + t.labtolms[row][1] * moved[1] +
+                     t.labtolms[row][2] * moved[2] + (1 << 13)) >> 14;
+      lms[row] = fixedexp2((log * LOG2_10 + (1 << 23)) >> 24, t);
+    }
+
+    unsigned char *out[3] = {&result[i].r, &result[i].g, &result[i].b};
+    for(int row = 0; row < 3; row++){
+      int64_t rgb = t.lmstorgb[row][0] * lms[0] + t.lmstorgb[row][1] * lms[1] +
+                    t.lmstorgb[row][2] * lms[2];
+      *out[row] = (unsigned char)min(llabs(rgb) * 255 >> 42, 255LL);
+    }
+  }
+}
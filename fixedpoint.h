@@ -0,0 +1,41 @@
+/*
+*   Fixed-point lαβ conversion for 8-bit images
+*
+*   The whole conversion runs in integers. RGB to LMS uses 16-bit fixed
+*   point coefficients (Q16), so LMS is an exact integer for each 8-bit
+*   color; its log10 comes from a 4096-entry table of mantissas. The lαβ
+*   matrices are 16-bit Q14 and LMS to RGB is 16-bit Q12, logs and lαβ are
+*   Q16 in 32 bits, and products are accumulated in 64 bits. The inverse
+*   log comes from a 4096-entry table of powers of two, and the per channel
+*   scale and offset are Q16.
+*
+*   lαβ is handed to the statistics and apply stages as float, which holds
+*   a Q16 value of the transfer's range exactly. ctbench reports the
+*   accuracy against the double-precision reference as the fixed kernel.
+*/
+
+#ifndef FIXEDPOINT_H
+#define FIXEDPOINT_H
+
+#include "transfer.h"
+
+#include <stdint.h>
+
+struct FixedTables;
+
+class FixedPipeline{
+private:
+  const FixedTables &t;
+
+public:
+  FixedPipeline();
+
+  // Convert n pixels to interleaved lαβ, clamping each channel at 1/255
+  void lab(const Pixel *pixels, int n, float *lab) const;
+  // Move n interleaved lαβ values by scale and offset and convert them
+  // back to RGB in result
+  void apply(const float *lab, int n, const float scale[3], const float offset[3],
+             Pixel *result) const;
+};
+
+#endif
@@ -0,0 +1,217 @@
+/*
+*   Histogram matching transfer
+*/
+
+#include "histogram.h"
+#include "scheduler.h"
+
+#include <cmath>
+#include <algorithm>
+#include <stdint.h>
+
+using namespace std;
+
+LabHistogram::LabHistogram(const float l[3], const float h[3]){
+  for(int c = 0; c < 3; c++){
+    low[c] = l[c];
+    high[c] = h[c];
+    bins[c].assign(HISTOGRAMBINS, 0);
+  }
+}
+
+/*
+   Unweighted values are counted in integers, a block at a time, which
+   keeps the repeated increments of one bin fast.
+*/
+void LabHistogram::add(const float *lab, long n, const long *counts){
+  float scale[3];
+  for(int c = 0; c < 3; c++)
+    scale[c] = high[c] > low[c] ? HISTOGRAMBINS / (high[c] - low[c]) : 0;
+
+  const long BLOCKVALUES = 1L << 30;   // fewer than overflow a count
+  vector<uint32_t> tally(3 * HISTOGRAMBINS);
+  for(long start = 0; start < n; start += BLOCKVALUES){
+    long end = min(n, start + BLOCKVALUES);
+    for(long i = start; i < end; i++)
+      for(int c = 0; c < 3; c++){
+        float t = (lab[3 * i + c] - low[c]) * scale[c];
+        int bin = t > 0 ? int(min(t, float(HISTOGRAMBINS - 1))) : 0;
+        if(counts)
+          bins[c][bin] += double(counts[i]);
+        else
+          tally[c * HISTOGRAMBINS + bin]++;
+      }
+    if(!counts)
+      for(int c = 0; c < 3; c++)
+        for(int b = 0; b < HISTOGRAMBINS; b++){
+          bins[c][b] += tally[c * HISTOGRAMBINS + b];
+          tally[c * HISTOGRAMBINS + b] = 0;
+        }
+  }
+}
+
+void LabHistogram::merge(const LabHistogram &part){
+  for(int c = 0; c < 3; c++)
+    for(int b = 0; b < HISTOGRAMBINS; b++)
+      bins[c][b] += part.bins[c][b];
+}
+
+/*
+   Eight pixels side by side, so that the compiler can keep the lanes in
+   vector registers.
+*/
+void labrange(const float *lab, long n, float low[3], float high[3]){
+  const int width = 3 * 8;
+  float lanelow[width], lanehigh[width];
+  for(int j = 0; j < width; j++){
+    lanelow[j] = low[j % 3];
+    lanehigh[j] = high[j % 3];
+  }
+  long whole = n - n % 8;
+  for(long i = 0; i < 3 * whole; i += width)
+    for(int j = 0; j < width; j++){
+      lanelow[j] = lab[i + j] < lanelow[j] ? lab[i + j] : lanelow[j];
+      lanehigh[j] = lab[i + j] > lanehigh[j] ? lab[i + j] : lanehigh[j];
+    }
+  for(long j = 0; j < 3 * (n - whole); j++){
+    lanelow[j] = min(lanelow[j], lab[3 * whole + j]);
+    lanehigh[j] = max(lanehigh[j], lab[3 * whole + j]);
+  }
+  for(int j = 0; j < width; j++){
+    low[j % 3] = min(low[j % 3], lanelow[j]);
+    high[j % 3] = max(high[j % 3], lanehigh[j]);
+  }
+}
+
+/*
+   How many pixels use each color of a palette image
+*/
+static void palettecounts(const LabImage &image, vector<long> &counts){
+  counts.assign(image.lab.size() / 3, 0);
+  for(size_t i = 0; i < image.indices.size(); i++)
+    counts[image.indices[i]]++;
+}
+
+// most pieces an image histogram is counted in, as each holds bins of its own
+const long HISTOGRAMPIECES = 64;
+
+/*
+   The range and then the counts are taken in pieces, each with its own
+   range or histogram, and those are combined in order once all are done.
+   A palette image is split by colors, with their pixel counts.
+*/
+LabHistogram imagehistogram(const LabImage &image, int nthreads, long piecepixels){
+  long n = long(image.lab.size() / 3);
+  const float *lab = image.lab.data();
+  long piece = piecepixels > 0 ? max(piecepixels, (n + HISTOGRAMPIECES - 1) / HISTOGRAMPIECES)
+                               : max(n, 1L);
+  long pieces = (n + piece - 1) / piece;
+
+  vector<float> partlow(3 * pieces, HUGE_VALF), parthigh(3 * pieces, -HUGE_VALF);
+  parallelpieces(n, piece, nthreads, [&](long start, long count){
+    long k = start / piece;
+    labrange(lab + 3 * start, count, &partlow[3 * k], &parthigh[3 * k]);
+  });
+  float low[3] = {HUGE_VALF, HUGE_VALF, HUGE_VALF};
+  float high[3] = {-HUGE_VALF, -HUGE_VALF, -HUGE_VALF};
+  for(long k = 0; k < pieces; k++)
+    for(int c = 0; c < 3; c++){
+      low[c] = min(low[c], partlow[3 * k + c]);
+      high[c] = max(high[c], parthigh[3 * k + c]);
+    }
+
+  vector<long> counts;
+  if(!image.indices.empty())
+    palettecounts(image, counts);
+  vector<LabHistogram> parts(pieces, LabHistogram(low, high));
+  parallelpieces(n, piece, nthreads, [&](long start, long count){
+    parts[start / piece].add(lab + 3 * start, count, counts.empty() ? NULL : &counts[start]);
+  });
+  LabHistogram histogram(low, high);
+  for(long k = 0; k < pieces; k++)
+    histogram.merge(parts[k]);
+  return histogram;
+}
+
+/*
+   Cumulative fraction of the counts at each of the HISTOGRAMBINS + 1 bin
+   edges, from 0 to 1.
+*/
+static void cumulative(const vector<double> &bins, vector<double> &cdf){
+  cdf.assign(HISTOGRAMBINS + 1, 0);
+  for(int b = 0; b < HISTOGRAMBINS; b++)
+    cdf[b + 1] = cdf[b] + bins[b];
+  double total = cdf[HISTOGRAMBINS];
+  for(int e = 0; e <= HISTOGRAMBINS; e++)
+    cdf[e] = total > 0 ? cdf[e] / total : 0;
+}
+
+/*
+   The value of each channel at the quantiles of the destination edges is
+   found in the source by walking both cumulative counts at once, taking
+   values as spread evenly within a bin. A destination with one value in a
+   channel maps it to the source median.
+*/
+HistogramMatch::HistogramMatch(const LabHistogram &source, const LabStats &sourcestats,
+                               const LabHistogram &dest, const LabStats &deststats,
+                               double blend){
+  vector<double> sourcecdf, destcdf;
+  for(int c = 0; c < 3; c++){
+    cumulative(source.bins[c], sourcecdf);
+    cumulative(dest.bins[c], destcdf);
+    bool flat = !(dest.high[c] > dest.low[c]);
+    double sourcestep = (double(source.high[c]) - source.low[c]) / HISTOGRAMBINS;
+    double deststep = flat ? 0 : (double(dest.high[c]) - dest.low[c]) / HISTOGRAMBINS;
+    low[c] = dest.low[c];
+    scale[c] = flat ? 0 : float(1 / deststep);
+
+    double deststddev = labstddev(deststats, c);
+    double ratio = deststddev > 0 ? labstddev(sourcestats, c) / deststddev : 0;
+
+    table[c].resize(HISTOGRAMBINS + 1);
+    int bin = 0;
+    for(int e = 0; e <= HISTOGRAMBINS; e++){
+      double q = flat ? 0.5 : destcdf[e];
+      while(bin < HISTOGRAMBINS - 1 && sourcecdf[bin + 1] < q)
+        bin++;
+      double width = sourcecdf[bin + 1] - sourcecdf[bin];
+      double fraction = width > 0 ? min(max((q - sourcecdf[bin]) / width, 0.0), 1.0) : 0;
+      double matched = source.low[c] + (bin + fraction) * sourcestep;
+
+      double value = dest.low[c] + e * deststep;
+      double reinhard = (value - deststats.mean[c]) * ratio + sourcestats.mean[c];
+      table[c][e] = float(blend * matched + (1 - blend) * reinhard);
+    }
+  }
+}
+
+void HistogramMatch::map(const float *lab, long n, float *matched) const{
+  const float *tables[3] = {table[0].data(), table[1].data(), table[2].data()};
+  for(long i = 0; i < n; i++)
+    for(int c = 0; c < 3; c++){
+      float t = min(max((lab[3 * i + c] - low[c]) * scale[c], 0.0f), float(HISTOGRAMBINS));
+      int edge = min(int(t), HISTOGRAMBINS - 1);
+      const float *at = tables[c] + edge;
+      matched[3 * i + c] = at[0] + (t - edge) * (at[1] - at[0]);
+    }
+}
+
+/*
+   A palette image is matched one color at a time and keeps its indices.
+*/
+void histogrammatch(const LabImage &source, const LabImage &dest,
+                    const LabHistogram &desthistogram, double blend, LabImage &matched,
+                    int nthreads, long piecepixels){
+  HistogramMatch match(imagehistogram(source, nthreads, piecepixels), source.stats,
+                       desthistogram, dest.stats, blend);
+
+  matched.lab.resize(dest.lab.size());
+  matched.indices = dest.indices;
+  match.map(dest.lab.data(), long(dest.lab.size() / 3), matched.lab.data());
+
+  matched.stats.count = dest.stats.count;
+  for(int c = 0; c < 3; c++){
+    matched.stats.mean[c] = 0;
+    matched.stats.m2[c] = dest.stats.count;
+  }
+}
@@ -0,0 +1,87 @@
+/*
+*   Histogram matching transfer
+*
+*   Reinhard et al. move each lαβ channel of the destination to the mean
+*   and standard deviation of the source; histogram matching moves every
+*   quantile of it to the source's. Each channel of an image is counted in
+*   HISTOGRAMBINS fixed bins between its least and greatest value, in one
+*   pass, and the counts of separate pieces of an image add. Walking the
+*   cumulative counts of the destination and the source together then gives
+*   the source value of every bin edge of the destination, so the match
+*   takes time linear in the pixels plus the bins, with no sort, and a value
+*   between edges is interpolated. blend mixes the match with the Reinhard
+*   move of the same value: 1 is the full match and 0 the Reinhard transfer.
+*
+*   The values are those of the kernel's LabImage, in its color space. The
+*   match replaces the values of a copy of it, one pass over the pixels or
+*   the palette, and the copy goes through the kernel's own apply stage with
+*   statistics that make the stage's move the identity, so it only converts
+*   back.
+*/
+
+#ifndef HISTOGRAM_H
+#define HISTOGRAM_H
+
+#include "transfer.h"
+
+#include <vector>
+
+const int HISTOGRAMBINS = 4096;
+
+//
+// Counts of the values of each channel in HISTOGRAMBINS bins from low to
+// high. Values outside the range count in the first or last bin.
+//
+struct LabHistogram{
+  float low[3], high[3];
+  std::vector<double> bins[3];
+
+  LabHistogram(const float low[3], const float high[3]);
+
+  // Count n interleaved values, each counts[i] times if counts is not NULL
+  void add(const float *lab, long n, const long *counts = NULL);
+  // Add the counts of part, which must have the same range
+  void merge(const LabHistogram &part);
+};
+
+// Widen low and high to take in n interleaved values; start them at +/-HUGE_VALF
+void labrange(const float *lab, long n, float low[3], float high[3]);
+
+//
+// The histogram of every pixel of an image, a palette color counting once
+// per pixel. It is counted in pieces of at least piecepixels, all at once
+// if 0, on nthreads threads, and the pieces merged.
+//
+LabHistogram imagehistogram(const LabImage &image, int nthreads = 1, long piecepixels = 0);
+
+//
+// The map of destination values to matched ones, as a table at the bin
+// edges of the destination histogram. map may be called from several
+// threads at once.
+//
+class HistogramMatch{
+private:
+  float low[3], scale[3];           // destination bin of a value is (value - low) * scale
+  std::vector<float> table[3];      // matched value at each of the HISTOGRAMBINS + 1 edges
+
+public:
+  HistogramMatch(const LabHistogram &source, const LabStats &sourcestats,
+                 const LabHistogram &dest, const LabStats &deststats, double blend);
+
+  void map(const float *lab, long n, float *matched) const;
+};
+
+//
+// The destination image with every value matched to the source, blended
+// with the Reinhard transfer by blend. desthistogram is imagehistogram(dest),
+// which many sources to one destination need only once. The statistics of
+// matched are of unit deviation about 0, so that with them as both source
+// and destination statistics the kernel's apply stage moves nothing. The
+// source histogram is counted as imagehistogram does with nthreads and
+// piecepixels.
+//
+void histogrammatch(const LabImage &source, const LabImage &dest,
+                    const LabHistogram &desthistogram, double blend, LabImage &matched,
+                    int nthreads = 1, long piecepixels = 0);
+
+#endif
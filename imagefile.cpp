@@ -0,0 +1,534 @@
+/*
+*   Image file input and output for the color transfer programs
+*/
+
+#include "imagefile.h"
+#include "scheduler.h"
+#include "pool.h"
+
+#include <iostream>
+#include <vector>
+#include <algorithm>
+#include <functional>
+#include <climits>
+#include <cstdio>
+#include <csetjmp>
+#include <OpenImageIO/imageio.h>
+#include <jpeglib.h>
+
+using namespace std;
+OIIO_NAMESPACE_USING
+
+/*
+   Read count scanlines from scanline first of the current subimage of an
+   open file into a bottom-up pixmap, as for readscanlines.
+*/
+static Pixel *readinput(ImageInput *infile, const string &infilename, int first, int count,
+                        int &width, int &rows){
+  // the file spec indicates the width, height and number of channels
+  int w = infile->spec().width;
+  int h = infile->spec().height;
+  int channels = infile->spec().nchannels;
+  if(first < 0 || first >= h || count <= 0){
+    cerr << "No scanlines from " << first << " in " << infilename << endl;
+    return NULL;
+  }
+  int n = min(count, h - first);
+
+  // allocate temporary structure to read the scanlines
+  unsigned char *tmp_pixels = poolnew<unsigned char>(long(w) * n * channels);
+
+  // read the scanlines into the tmp_pixels from the input file, flipping them upside down using negative y-stride,
+  // since OpenGL pixmaps have the bottom scanline first, and
+  // oiio expects the top scanline first in the image file.
+  long scanlinesize = long(w) * channels * sizeof(unsigned char);
+  if(!infile->read_scanlines(first, first + n, 0, TypeDesc::UINT8, tmp_pixels + (n - 1) * scanlinesize,
+                             AutoStride, -scanlinesize)){
+    cerr << "Could not read image from " << infilename << ", error = " << geterror() << endl;
+    poolfree(tmp_pixels);
+    return NULL;
+  }
+
+  //  assign the read pixels to the pixmap
+  Pixel *pixmap = poolnew<Pixel>(long(w) * n);
+  for(long i = 0; i < long(w) * n; i++){
+    unsigned char *p = tmp_pixels + i * channels;
+    if(channels < 3){
+      pixmap[i].r = pixmap[i].g = pixmap[i].b = p[0];
+      pixmap[i].a = channels == 2 ? p[1] : 255;
+    }
+    else{
+      pixmap[i].r = p[0];
+      pixmap[i].g = p[1];
+      pixmap[i].b = p[2];
+      if(channels < 4) // no alpha value is present so set it to 255
+        pixmap[i].a = 255;
+      else // read the alpha value
+        pixmap[i].a = p[3];
+    }
+  }
+  poolfree(tmp_pixels);
+
+  width = w;
+  rows = n;
+  return pixmap;
+}
+
+bool readimagesize(const string &infilename, int &width, int &height){
+  ImageInput *infile = ImageInput::open(infilename);
+  if(!infile){
+    cerr << "Could not input image file " << infilename << ", error = " << geterror() << endl;
+    return false;
+  }
+  width = infile->spec().width;
+  height = infile->spec().height;
+  infile->close();
+  ImageInput::destroy(infile);
+  return true;
+}
+
+Pixel *readscanlines(const string &infilename, int first, int count,
+                     int &width, int &rows, int &height){
+  // Create the oiio file handler for the image, and open the file for reading the image.
+  ImageInput *infile = ImageInput::open(infilename);
+  if(!infile){
+    cerr << "Could not input image file " << infilename << ", error = " << geterror() << endl;
+    return NULL;
+  }
+
+  Pixel *pixmap = readinput(infile, infilename, first, count, width, rows);
+  height = infile->spec().height;
+
+  // close the image file after reading, and free up space for the oiio file handler
+  infile->close();
+  ImageInput::destroy(infile);
+  return pixmap;
+}
+
+Pixel *readpixmap(const string &infilename, int &width, int &height){
+  int rows;
+  return readscanlines(infilename, 0, INT_MAX, width, rows, height);
+}
+
+//
+// libjpeg reports errors through a longjmp back to readjpeg or writejpeg
+//
+struct JpegError{
+  jpeg_error_mgr manager;
+  jmp_buf jump;
+};
+
+static void jpegerror(j_common_ptr cinfo){
+  char message[JMSG_LENGTH_MAX];
+  (*cinfo->err->format_message)(cinfo, message);
+  cerr << "JPEG error: " << message << endl;
+  longjmp(((JpegError *)cinfo->err)->jump, 1);
+}
+
+/*
+   Decode a JPEG file with libjpeg at the smallest of 1/8, 1/4 and 1/2
+   scale, or full size, that is at least minwidth x minheight. The scaling
+   is done by the inverse DCT, so most of the decode is skipped rather than
+   the pixels thrown away afterwards. Returns NULL, leaving the file to
+   OIIO, for CMYK files and on errors.
+*/
+static Pixel *readjpeg(const string &infilename, int minwidth, int minheight,
+                       int &width, int &height, int &reduction){
+  FILE *file = fopen(infilename.c_str(), "rb");
+  if(!file)
+    return NULL;
+
+  jpeg_decompress_struct cinfo;
+  JpegError error;
+  // plain pointers, as an error longjmps back over anything made after setjmp
+  Pixel *volatile pixmap = NULL;
+  unsigned char *volatile scanline = NULL;
+  cinfo.err = jpeg_std_error(&error.manager);
+  error.manager.error_exit = jpegerror;
+  if(setjmp(error.jump)){
+    jpeg_destroy_decompress(&cinfo);
+    fclose(file);
+    poolfree(pixmap);
+    poolfree(scanline);
+    return NULL;
+  }
+  jpeg_create_decompress(&cinfo);
+  jpeg_stdio_src(&cinfo, file);
+  jpeg_read_header(&cinfo, TRUE);
+  if(cinfo.jpeg_color_space == JCS_CMYK || cinfo.jpeg_color_space == JCS_YCCK){
+    jpeg_destroy_decompress(&cinfo);
+    fclose(file);
+    return NULL;
+  }
+
+  int denom = 8;
+  while(denom > 1 && (long(cinfo.image_width + denom - 1) / denom < minwidth ||
+                      long(cinfo.image_height + denom - 1) / denom < minheight))
+    denom /= 2;
+  cinfo.scale_num = 1;
+  cinfo.scale_denom = denom;
+  jpeg_start_decompress(&cinfo);
+
+  int w = cinfo.output_width, h = cinfo.output_height, channels = cinfo.output_components;
+  pixmap = poolnew<Pixel>(long(w) * h);
+  scanline = poolnew<unsigned char>(long(w) * channels);
+  while(cinfo.output_scanline < cinfo.output_height){
+    // file scanline y is pixmap row h - 1 - y
+    Pixel *row = pixmap + long(h - 1 - int(cinfo.output_scanline)) * w;
+    JSAMPROW line = scanline;
+    jpeg_read_scanlines(&cinfo, &line, 1);
+    for(int x = 0; x < w; x++){
+      const unsigned char *p = &scanline[long(x) * channels];
+      row[x].r = p[0];
+      row[x].g = p[channels < 3 ? 0 : 1];
+      row[x].b = p[channels < 3 ? 0 : 2];
+      row[x].a = 255;
+    }
+  }
+  jpeg_finish_decompress(&cinfo);
+  jpeg_destroy_decompress(&cinfo);
+  fclose(file);
+  poolfree(scanline);
+
+  width = w;
+  height = h;
+  reduction = denom;
+  return pixmap;
+}
+
+bool isjpeg(const string &filename){
+  size_t dot = filename.rfind('.');
+  if(dot == string::npos)
+    return false;
+  string ext = filename.substr(dot);
+  transform(ext.begin(), ext.end(), ext.begin(), ::tolower);
+  return ext == ".jpg" || ext == ".jpeg";
+}
+
+Pixel *readreducedpixmap(const string &infilename, int minwidth, int minheight,
+                         int &width, int &height, int &reduction){
+  if(isjpeg(infilename)){
+    Pixel *pixmap = readjpeg(infilename, minwidth, minheight, width, height, reduction);
+    if(pixmap)
+      return pixmap;
+  }
+
+  ImageInput *infile = ImageInput::open(infilename);
+  if(!infile){
+    cerr << "Could not input image file " << infilename << ", error = " << geterror() << endl;
+    return NULL;
+  }
+
+  // the smallest MIP level that is still large enough
+  int fullwidth = infile->spec().width, level = 0;
+  ImageSpec spec;
+  while(infile->seek_subimage(0, level + 1, spec) &&
+        spec.width >= minwidth && spec.height >= minheight)
+    level++;
+  infile->seek_subimage(0, level, spec);
+
+  int rows;
+  Pixel *pixmap = readinput(infile, infilename, 0, INT_MAX, width, rows);
+  height = rows;
+  reduction = max(fullwidth / max(width, 1), 1);
+
+  infile->close();
+  ImageInput::destroy(infile);
+  return pixmap;
+}
+
+bool writepixmap(const string &outfilename, const Pixel *pixmap, int width, int height){
+  // create the oiio file handler for the image
+  ImageOutput *outfile = ImageOutput::create(outfilename);
+  if(!outfile){
+    cerr << "Could not create output image for " << outfilename << ", error = " << geterror() << endl;
+    return false;
+  }
+
+  // Open a file for writing the image. The file header will indicate an image of
+  // width by height RGBA pixels, with channels of type unsigned char
+  ImageSpec spec(width, height, 4, TypeDesc::UINT8);
+  if(!outfile->open(outfilename, spec)){
+    cerr << "Could not open " << outfilename << ", error = " << geterror() << endl;
+    ImageOutput::destroy(outfile);
+    return false;
+  }
+
+  // Write the image to the file, flipping it upside down by using negative y stride,
+  // since the pixmap has the bottom scanline first, and oiio writes the top scanline first in the image file.
+  long scanlinesize = long(width) * sizeof(Pixel);
+  const unsigned char *top = (const unsigned char *)pixmap + (height - 1) * scanlinesize;
+  if(!outfile->write_image(TypeDesc::UINT8, top, AutoStride, -scanlinesize)){
+    cerr << "Could not write image to " << outfilename << ", error = " << geterror() << endl;
+    ImageOutput::destroy(outfile);
+    return false;
+  }
+
+  // close the image file after the image is written and free up space for the
+  // ooio file handler
+  outfile->close();
+  ImageOutput::destroy(outfile);
+  return true;
+}
+
+/*
+   The alpha is dropped, as JPEG has none. A file left half written by an
+   error is removed.
+*/
+bool writejpeg(const string &outfilename, const Pixel *pixmap, int width, int height,
+               int quality){
+  FILE *file = fopen(outfilename.c_str(), "wb");
+  if(!file){
+    cerr << "Could not open " << outfilename << endl;
+    return false;
+  }
+
+  jpeg_compress_struct cinfo;
+  JpegError error;
+  vector<unsigned char> scanline(long(width) * 3);
+  cinfo.err = jpeg_std_error(&error.manager);
+  error.manager.error_exit = jpegerror;
+  if(setjmp(error.jump)){
+    jpeg_destroy_compress(&cinfo);
+    fclose(file);
+    remove(outfilename.c_str());
+    return false;
+  }
+  jpeg_create_compress(&cinfo);
+  jpeg_stdio_dest(&cinfo, file);
+  cinfo.image_width = width;
+  cinfo.image_height = height;
+  cinfo.input_components = 3;
+  cinfo.in_color_space = JCS_RGB;
+  jpeg_set_defaults(&cinfo);
+  jpeg_set_quality(&cinfo, quality, TRUE);
+  jpeg_start_compress(&cinfo, TRUE);
+  while(cinfo.next_scanline < cinfo.image_height){
+    // file scanline y is pixmap row height - 1 - y
+    const Pixel *row = pixmap + long(height - 1 - int(cinfo.next_scanline)) * width;
+    for(int x = 0; x < width; x++){
+      scanline[3 * long(x)] = row[x].r;
+      scanline[3 * long(x) + 1] = row[x].g;
+      scanline[3 * long(x) + 2] = row[x].b;
+    }
+    JSAMPROW line = &scanline[0];
+    jpeg_write_scanlines(&cinfo, &line, 1);
+  }
+  jpeg_finish_compress(&cinfo);
+  jpeg_destroy_compress(&cinfo);
+  if(fclose(file) != 0){
+    cerr << "Could not write image to " << outfilename << endl;
+    return false;
+  }
+  return true;
+}
+
+// pixels in a band of scanlines written by writetransfer
+const long BANDPIXELS = 65536;
+
+/*
+   Write dest to an image file in bands of scanlines, top first, with the r,
+   g and b of its covered pixels from covered. covered(start, first, last)
+   returns the covered pixels start onwards, in pixmap order, of spans first
+   to last - 1, which are those of one band, or NULL on failure. A file left
+   half written by an error is removed.
+*/
+static bool writebands(const string &outfilename, const Pixel *dest, int width, int height,
+                       const Mask &mask,
+                       const function<const Pixel *(long, long, long)> &covered){
+  ImageOutput *outfile = ImageOutput::create(outfilename);
+  if(!outfile){
+    cerr << "Could not create output image for " << outfilename << ", error = " << geterror() << endl;
+    return false;
+  }
+  ImageSpec spec(width, height, 4, TypeDesc::UINT8);
+  if(!outfile->open(outfilename, spec)){
+    cerr << "Could not open " << outfilename << ", error = " << geterror() << endl;
+    ImageOutput::destroy(outfile);
+    return false;
+  }
+
+  auto fail = [&](){
+    outfile->close();
+    ImageOutput::destroy(outfile);
+    remove(outfilename.c_str());
+    return false;
+  };
+
+  int bandrows = int(max(BANDPIXELS / max(width, 1), 1L));
+  PoolVector<Pixel> band(long(width) * bandrows);
+  const vector<Span> &spans = mask.spans();
+  long nspans = long(spans.size());   // spans below the bands written so far
+  long ncovered = mask.covered();     // and the pixels they cover
+
+  for(int top = 0; top < height; top += bandrows){
+    int rows = min(bandrows, height - top);
+
+    // file scanline top + r is pixmap row height - 1 - top - r
+    for(int r = 0; r < rows; r++){
+      const Pixel *row = dest + long(height - 1 - top - r) * width;
+      copy(row, row + width, &band[long(r) * width]);
+    }
+
+    // the spans of the band are the last ones not yet done, in pixmap order
+    long bottom = long(height - top - rows) * width;
+    long first = nspans, n = 0;
+    while(first > 0 && spans[first - 1].start >= bottom){
+      first--;
+      n += spans[first].length;
+    }
+
+    if(n > 0){
+      const Pixel *in = covered(ncovered - n, first, nspans);
+      if(!in)
+        return fail();
+
+      for(long i = first; i < nspans; i++){
+        long y = spans[i].start / width, x = spans[i].start % width;
+        Pixel *out = &band[(height - 1 - top - y) * width + x];
+        for(long j = 0; j < spans[i].length; j++, in++){
+          out[j].r = in->r;
+          out[j].g = in->g;
+          out[j].b = in->b;
+        }
+      }
+    }
+    nspans = first;
+    ncovered -= n;
+
+    if(!outfile->write_scanlines(top, top + rows, 0, TypeDesc::UINT8, &band[0])){
+      cerr << "Could not write image to " << outfilename << ", error = " << geterror() << endl;
+      return fail();
+    }
+  }
+
+  if(!outfile->close()){
+    cerr << "Could not write image to " << outfilename << ", error = " << geterror() << endl;
+    return fail();
+  }
+  ImageOutput::destroy(outfile);
+  return true;
+}
+
+bool writetransfer(const string &outfilename, const ColorTransfer &transfer,
+                   const Pixel *dest, int width, int height, const Mask &mask,
+                   const LabImage *destimage){
+  const vector<Span> &spans = mask.spans();
+  PoolVector<Pixel> covered;
+  return writebands(outfilename, dest, width, height, mask,
+                    [&](long start, long first, long last) -> const Pixel *{
+    long n = 0;
+    for(long i = first; i < last; i++)
+      n += spans[i].length;
+    covered.resize(n);
+    Pixel *in = &covered[0];
+    bool transferred;
+    if(destimage)
+      transferred = transfer.apply(*destimage, start, n, in);
+    else{
+      for(long i = first; i < last; i++){
+        copy(dest + spans[i].start, dest + spans[i].start + spans[i].length, in);
+        in += spans[i].length;
+      }
+      in = &covered[0];
+      transferred = transfer.apply(in, in, n);
+    }
+    if(!transferred){
+      cerr << "No statistics to transfer " << outfilename << " with" << endl;
+      return NULL;
+    }
+    return in;
+  });
+}
+
+bool writemasked(const string &outfilename, const Pixel *dest, int width, int height,
+                 const Mask &mask, const Pixel *covered){
+  return writebands(outfilename, dest, width, height, mask,
+                    [=](long start, long, long){ return covered + start; });
+}
+
+/*
+   The inverse of the matrix that scales a width x height pixmap to
+   newwidth x newheight and moves the bounds of the result to the origin,
+   and the size of the result.
+*/
+static Matrix3D scaleinverse(int width, int height, int newwidth, int newheight,
+                             int &scaledwidth, int &scaledheight){
+  // scale matrix taking the pixmap to the new size
+  double scale[3][3] = {{double(newwidth) / double(width), 0, 0},
+                        {0, double(newheight) / double(height), 0},
+                        {0, 0, 1}};
+  const Matrix3D M(scale);
+
+  // map each corner of the image to find the bounds of the result
+  Vector3D corners[4] = {Vector3D(0, 0, 1), Vector3D(width, 0, 1),
+                         Vector3D(0, height, 1), Vector3D(width, height, 1)};
+  double top = 0, bottom = 0, left = 0, right = 0;
+  for(int i = 0; i < 4; i++){
+    Vector3D v = M * corners[i];
+    v.x /= v.z;
+    v.y /= v.z;
+    if(i == 0 || v.y > top)
+      top = v.y;
+    if(i == 0 || v.y < bottom)
+      bottom = v.y;
+    if(i == 0 || v.x < left)
+      left = v.x;
+    if(i == 0 || v.x > right)
+      right = v.x;
+  }
+
+  // translate the bounds to the origin
+  double coefs[3][3] = {{1, 0, -left}, {0, 1, -bottom}, {0, 0, 1}};
+  Matrix3D tr(coefs);
+
+  scaledwidth = right - left;
+  scaledheight = top - bottom;
+  return (tr * M).inverse();
+}
+
+PixmapScale::PixmapScale(const Pixel *p, int w, int h, int newwidth, int newheight)
+  : pixmap(p), sourcewidth(w), sourceheight(h), same(w == newwidth && h == newheight),
+    inverse(scaleinverse(w, h, newwidth, newheight, width, height)){
+  if(same){
+    width = w;
+    height = h;
+  }
+}
+
+long PixmapScale::bandrows(long piecepixels) const{
+  return piecepixels > 0 ? max(piecepixels / max(width, 1), 1L) : max(height, 1);
+}
+
+/*
+   Inverse map every pixel of the band into the pixmap
+*/
+void PixmapScale::band(long first, long rows, Pixel *scaled) const{
+  if(same){
+    copy(pixmap + first * width, pixmap + (first + rows) * width, scaled + first * width);
+    return;
+  }
+  fill(scaled + first * width, scaled + (first + rows) * width, Pixel());
+  for(long y = first; y < first + rows; y++)
+    for(int x = 0; x < width; x++){
+      Vector3D pixel_out(x, y, 1);
+      Vector3D pixel_in = inverse * pixel_out;
+
+      int u = pixel_in.x / pixel_in.z;
+      int v = pixel_in.y / pixel_in.z;
+      if(u >= 0 && u < sourcewidth && v >= 0 && v < sourceheight)
+        scaled[y * width + x] = pixmap[long(v) * sourcewidth + u];
+    }
+}
+
+Pixel *scalepixmap(const Pixel *pixmap, int width, int height, int newwidth, int newheight,
+                   int &scaledwidth, int &scaledheight, int nthreads, long piecepixels){
+  PixmapScale scale(pixmap, width, height, newwidth, newheight);
+  Pixel *scaled = poolnew<Pixel>(long(scale.width) * scale.height);
+  parallelpieces(scale.height, scale.bandrows(piecepixels), nthreads, [&](long first, long rows){
+    scale.band(first, rows, scaled);
+  });
+  scaledwidth = scale.width;
+  scaledheight = scale.height;
+  return scaled;
+}
@@ -0,0 +1,116 @@
+/*
+*   Image file input and output for the color transfer programs
+*/
+
+#ifndef IMAGEFILE_H
+#define IMAGEFILE_H
+
+#include "transfer.h"
+#include "mask.h"
+#include "matrix.h"
+
+#include <string>
+
+//
+// Read an image file into a newly allocated, contiguous RGBA pixmap with the
+// bottom scanline first, as OpenGL expects. Gray images are expanded to RGB
+// and a missing alpha channel is set to 255.
+// Returns NULL on failure, otherwise the caller owns the pixmap, which comes
+// from the buffer pool (poolfree, pool.h).
+//
+Pixel *readpixmap(const std::string &infilename, int &width, int &height);
+
+//
+// The same for only count scanlines from scanline first, counted from the
+// top as the file stores them, so that a tile of a large image can be read
+// on its own. rows is count, or fewer at the bottom of the image, and height
+// is the height of the whole image. Returns NULL if first is past the bottom.
+//
+Pixel *readscanlines(const std::string &infilename, int first, int count,
+                     int &width, int &rows, int &height);
+
+//
+// Read only the header of an image file for its size. Returns false on failure.
+//
+bool readimagesize(const std::string &infilename, int &width, int &height);
+
+//
+// Read an image file at reduced resolution, for when only its statistics
+// are needed: the smallest size that is at least minwidth x minheight,
+// or the whole image if it is smaller. JPEG files are decoded at 1/2, 1/4
+// or 1/8 scale by libjpeg, files with MIP levels are read from the level
+// that fits, and others are read at full size. reduction is the factor the
+// width was divided by, 1 for a full size read.
+//
+Pixel *readreducedpixmap(const std::string &infilename, int minwidth, int minheight,
+                         int &width, int &height, int &reduction);
+
+// Whether a file name ends in .jpg or .jpeg, which readreducedpixmap decodes reduced
+bool isjpeg(const std::string &filename);
+
+//
+// Write a bottom-up RGBA pixmap to an image file. Returns false on failure.
+//
+bool writepixmap(const std::string &outfilename, const Pixel *pixmap, int width, int height);
+
+//
+// Write the r, g and b of a bottom-up pixmap to a JPEG file with libjpeg,
+// at quality 0 to 100, whatever the name of the file. Returns false on failure.
+//
+bool writejpeg(const std::string &outfilename, const Pixel *pixmap, int width, int height,
+               int quality = 90);
+
+//
+// Transfer a width x height destination straight into an image file, in
+// bands of scanlines that are filled top first, as the file stores them,
+// from the destination pixels. The covered pixels of each band are
+// transferred, from destimage if it is not NULL, and the others, like the
+// alpha, are written as they are. Returns false on failure.
+//
+bool writetransfer(const std::string &outfilename, const ColorTransfer &transfer,
+                   const Pixel *dest, int width, int height, const Mask &mask,
+                   const LabImage *destimage = NULL);
+
+//
+// The same with the covered pixels already transferred, in mask order, in
+// covered.
+//
+bool writemasked(const std::string &outfilename, const Pixel *dest, int width, int height,
+                 const Mask &mask, const Pixel *covered);
+
+//
+// The nearest neighbor resampling of scalepixmap a band of scanlines at a
+// time, so that the bands can run as separate tasks. The result is width x
+// height, which can be a pixel short of newwidth x newheight; band fills
+// rows scanlines of it from scanline first, and may be called from several
+// threads at once.
+//
+class PixmapScale{
+public:
+  int width, height;
+
+private:
+  const Pixel *pixmap;
+  int sourcewidth, sourceheight;
+  bool same;          // the result is the pixmap, copied
+  Matrix3D inverse;   // from a pixel of the result to one of the pixmap
+
+public:
+  PixmapScale(const Pixel *pixmap, int width, int height, int newwidth, int newheight);
+
+  // Scanlines in a band of about piecepixels, all of them if 0
+  long bandrows(long piecepixels) const;
+  void band(long first, long rows, Pixel *scaled) const;
+};
+
+//
+// Resample a pixmap to newwidth x newheight with nearest neighbor inverse
+// mapping. The size of the result, which can be a pixel short of the one
+// asked for, is returned in scaledwidth and scaledheight, and the caller
+// owns it (poolfree). The result is made in bands of about piecepixels,
+// all of it at once if 0, on nthreads threads.
+//
+Pixel *scalepixmap(const Pixel *pixmap, int width, int height, int newwidth, int newheight,
+                   int &scaledwidth, int &scaledheight, int nthreads = 1, long piecepixels = 0);
+
+#endif
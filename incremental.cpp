@@ -0,0 +1,164 @@
+/*
+*   Incremental re-transfer of a destination that is edited in place
+*/
+
+#include "incremental.h"
+#include "moments.h"
+#include "scheduler.h"
+
+#include <cmath>
+#include <algorithm>
+
+using namespace std;
+
+IncrementalTransfer::IncrementalTransfer(const TransferKernel *k, const LabStats &sourcestats,
+                                         const Pixel *d, int w, int h, double tol, int n,
+                                         int size)
+  : kernel(k), source(sourcestats), dest(d), width(w), height(h), tilesize(max(size, 1)),
+    tolerance(tol), nthreads(max(n, 1)), updates(0){
+  tilesx = (width + tilesize - 1) / tilesize;
+  tilesy = (height + tilesize - 1) / tilesize;
+  partials.resize(long(tilesx) * tilesy);
+  transferred = poolnew<Pixel>(long(width) * height);
+
+  parallelpieces(long(partials.size()), 1, nthreads, [this](long tile, long){
+    tilestats(tile, partials[tile]);
+  });
+  mergepartials();
+  applied = total;
+
+  vector<long> all(partials.size());
+  for(size_t t = 0; t < all.size(); t++)
+    all[t] = long(t);
+  applytiles(all);
+}
+
+IncrementalTransfer::~IncrementalTransfer(){
+  poolfree(transferred);
+}
+
+Rect IncrementalTransfer::tilerect(long tile) const{
+  Rect r;
+  r.x = int(tile % tilesx) * tilesize;
+  r.y = int(tile / tilesx) * tilesize;
+  r.width = min(tilesize, width - r.x);
+  r.height = min(tilesize, height - r.y);
+  return r;
+}
+
+/*
+   A tile's rows are gathered into one run, so that the kernel sees whole
+   blocks.
+*/
+Rect IncrementalTransfer::gathertile(long tile, PoolVector<Pixel> &pixels) const{
+  Rect r = tilerect(tile);
+  pixels.resize(long(r.width) * r.height);
+  for(int row = 0; row < r.height; row++){
+    const Pixel *line = dest + long(r.y + row) * width + r.x;
+    copy(line, line + r.width, &pixels[long(row) * r.width]);
+  }
+  return r;
+}
+
+void IncrementalTransfer::tilestats(long tile, LabStats &stats) const{
+  PoolVector<Pixel> pixels;
+  gathertile(tile, pixels);
+  kernel->stats(&pixels[0], long(pixels.size()), stats);
+}
+
+// transfer the tiles from the destination into the result with the applied statistics
+void IncrementalTransfer::applytiles(const vector<long> &tiles){
+  ColorTransfer transfer(kernel);
+  transfer.setstats(source, applied);
+  parallelpieces(long(tiles.size()), 1, nthreads, [&](long k, long){
+    PoolVector<Pixel> pixels;
+    Rect r = gathertile(tiles[k], pixels);
+    transfer.apply(&pixels[0], &pixels[0], long(pixels.size()));
+    for(int row = 0; row < r.height; row++)
+      copy(&pixels[long(row) * r.width], &pixels[long(row) * r.width] + r.width,
+           transferred + long(r.y + row) * width + r.x);
+  });
+}
+
+void IncrementalTransfer::mergepartials(){
+  total.count = 0;
+  for(int c = 0; c < 3; c++)
+    total.mean[c] = total.m2[c] = 0;
+  for(size_t t = 0; t < partials.size(); t++)
+    mergestats(total, partials[t]);
+  updates = 0;
+}
+
+/*
+   How far statistics now are from before, as IncrementalUpdate::shift. A
+   channel that was flat and no longer is counts as infinitely far.
+*/
+static double statsshift(const LabStats &now, const LabStats &before){
+  double shift = 0;
+  for(int c = 0; c < 3; c++){
+    double deviation = labstddev(before, c), nowdeviation = labstddev(now, c);
+    if(deviation > 0)
+      shift = max(shift, max(fabs(now.mean[c] - before.mean[c]) / deviation,
+                             fabs(nowdeviation / deviation - 1)));
+    else if(nowdeviation > 0 || now.mean[c] != before.mean[c])
+      shift = HUGE_VAL;
+  }
+  return shift;
+}
+
+/*
+   The new statistics of the dirty tiles are read in parallel, then
+   replace the old ones in the total in order.
+*/
+IncrementalUpdate IncrementalTransfer::update(const vector<Rect> &dirty){
+  vector<bool> marked(partials.size(), false);
+  vector<long> tiles;
+  for(size_t i = 0; i < dirty.size(); i++){
+    int left = max(dirty[i].x, 0), bottom = max(dirty[i].y, 0);
+    int right = min(dirty[i].x + dirty[i].width, width);
+    int top = min(dirty[i].y + dirty[i].height, height);
+    if(left >= right || bottom >= top)
+      continue;
+    for(int ty = bottom / tilesize; ty <= (top - 1) / tilesize; ty++)
+      for(int tx = left / tilesize; tx <= (right - 1) / tilesize; tx++){
+        long tile = long(ty) * tilesx + tx;
+        if(!marked[tile]){
+          marked[tile] = true;
+          tiles.push_back(tile);
+        }
+      }
+  }
+  sort(tiles.begin(), tiles.end());
+
+  vector<LabStats> fresh(tiles.size());
+  parallelpieces(long(tiles.size()), 1, nthreads, [&](long k, long){
+    tilestats(tiles[k], fresh[k]);
+  });
+  for(size_t k = 0; k < tiles.size(); k++){
+    removestats(total, partials[tiles[k]]);
+    mergestats(total, fresh[k]);
+    partials[tiles[k]] = fresh[k];
+  }
+  if(++updates >= INCREMENTALREMERGE)
+    mergepartials();
+
+  IncrementalUpdate report;
+  report.tiles = long(tiles.size());
+  report.shift = statsshift(total, applied);
+  report.full = report.shift > tolerance;
+  if(report.full){
+    mergepartials();
+    applied = total;
+    tiles.resize(partials.size());
+    for(size_t t = 0; t < tiles.size(); t++)
+      tiles[t] = long(t);
+  }
+  applytiles(tiles);
+
+  report.applied = 0;
+  for(size_t k = 0; k < tiles.size(); k++){
+    Rect r = tilerect(tiles[k]);
+    report.applied += long(r.width) * r.height;
+  }
+  return report;
+}
@@ -0,0 +1,96 @@
+/*
+*   Incremental re-transfer of a destination that is edited in place
+*
+*   A retouching tool changes the destination a brush stroke at a time and
+*   wants the transfer of the whole image after each one. The destination
+*   is cut into square tiles, and the lαβ statistics of every tile are kept.
+*   When some rectangles of the destination have changed, only the tiles
+*   they touch are read again: the old statistics of each are taken out of
+*   those of the whole image and the new ones merged in (moments.h). If the
+*   statistics of the whole image have then moved further than a tolerance
+*   from the ones the result was made with, all of it is transferred again
+*   with the new ones; otherwise only the changed tiles are, with the same
+*   statistics as the rest of the result. Either way the work of an update
+*   follows the size of the edit, not of the image, until the edits add up
+*   to a change in the statistics.
+*/
+
+#ifndef INCREMENTAL_H
+#define INCREMENTAL_H
+
+#include "transfer.h"
+
+#include <vector>
+
+const int INCREMENTALTILE = 128;              // tiles are this many pixels square
+const double INCREMENTALTOLERANCE = 0.01;     // default, in destination standard deviations
+const int INCREMENTALREMERGE = 64;            // updates between merging the tiles afresh
+
+//
+// A rectangle of a pixmap, with row 0 at the bottom as in the pixmaps
+//
+struct Rect{
+  int x, y;
+  int width, height;
+};
+
+//
+// What an update did: the tiles whose statistics were read again, the
+// pixels transferred again, whether that was all of them, and how far the
+// destination statistics are from those of the result: the largest change
+// of a mean, in standard deviations, or of a standard deviation, relative.
+//
+struct IncrementalUpdate{
+  long tiles;
+  long applied;
+  bool full;
+  double shift;
+};
+
+class IncrementalTransfer{
+private:
+  const TransferKernel *kernel;
+  LabStats source;
+  const Pixel *dest;
+  int width, height;
+  int tilesize, tilesx, tilesy;
+  double tolerance;
+  int nthreads;
+
+  std::vector<LabStats> partials;   // of every tile, by rows of tiles from the bottom
+  LabStats total;                   // of the whole destination
+  LabStats applied;                 // destination statistics the result was made with
+  Pixel *transferred;
+  int updates;                      // since total was last merged from the partials
+
+  Rect tilerect(long tile) const;
+  Rect gathertile(long tile, PoolVector<Pixel> &pixels) const;
+  void tilestats(long tile, LabStats &stats) const;
+  void applytiles(const std::vector<long> &tiles);
+  void mergepartials();
+
+  IncrementalTransfer(const IncrementalTransfer &) = delete;
+  IncrementalTransfer &operator=(const IncrementalTransfer &) = delete;
+
+public:
+  //
+  // Transfer all of a width x height destination with the source
+  // statistics of kernel, keeping the statistics of every tile. The
+  // destination is not copied: the caller edits it in place and then calls
+  // update. Tiles are read and transferred on nthreads threads.
+  //
+  IncrementalTransfer(const TransferKernel *kernel, const LabStats &sourcestats,
+                      const Pixel *dest, int width, int height,
+                      double tolerance = INCREMENTALTOLERANCE, int nthreads = 1,
+                      int tilesize = INCREMENTALTILE);
+  ~IncrementalTransfer();
+
+  // The destination has changed within the dirty rectangles, which are clipped to it
+  IncrementalUpdate update(const std::vector<Rect> &dirty);
+
+  // the transferred destination, with its alpha
+  const Pixel *result() const { return transferred; }
+  const LabStats &deststats() const { return total; }
+};
+
+#endif
@@ -0,0 +1,76 @@
+/*
+*   Masks of the pixels a transfer covers
+*/
+
+#include "mask.h"
+
+#include <algorithm>
+
+using namespace std;
+
+Mask::Mask(): ncovered(0){
+}
+
+/*
+   Find the runs of pixels for which covered is true, one scanline at a
+   time.
+*/
+template<class Covered>
+void Mask::build(const Pixel *pixels, int width, int height, Covered covered){
+  runs.clear();
+  ncovered = 0;
+
+  for(int y = 0; y < height; y++){
+    const Pixel *row = pixels + long(y) * width;
+    for(int x = 0; x < width; x++){
+      if(!covered(row[x]))
+        continue;
+      int end = x + 1;
+      while(end < width && covered(row[end]))
+        end++;
+
+      Span span = {long(y) * width + x, long(end - x)};
+      runs.push_back(span);
+      ncovered += span.length;
+      x = end;
+    }
+  }
+}
+
+static bool opaque(const Pixel &p) { return p.a != 0; }
+static bool white(const Pixel &p) { return p.r >= 128; }
+
+void Mask::full(int width, int height){
+  runs.clear();
+  for(int y = 0; y < height; y++){
+    Span span = {long(y) * width, long(width)};
+    runs.push_back(span);
+  }
+  ncovered = long(width) * height;
+}
+
+void Mask::fromalpha(const Pixel *pixels, int width, int height){
+  build(pixels, width, height, opaque);
+}
+
+void Mask::fromimage(const Pixel *pixels, int width, int height){
+  build(pixels, width, height, white);
+}
+
+void Mask::gather(const Pixel *pixels, Pixel *out) const{
+  for(size_t i = 0; i < runs.size(); i++){
+    copy(pixels + runs[i].start, pixels + runs[i].start + runs[i].length, out);
+    out += runs[i].length;
+  }
+}
+
+void Mask::scatter(const Pixel *in, Pixel *pixels) const{
+  for(size_t i = 0; i < runs.size(); i++){
+    Pixel *out = pixels + runs[i].start;
+    for(long j = 0; j < runs[i].length; j++, in++){
+      out[j].r = in->r;
+      out[j].g = in->g;
+      out[j].b = in->b;
+    }
+  }
+}
@@ -0,0 +1,51 @@
+/*
+*   Masks of the pixels a transfer covers
+*/
+
+#ifndef MASK_H
+#define MASK_H
+
+#include "transfer.h"
+
+#include <vector>
+
+//
+// A run of covered pixels, start to start + length - 1, within one scanline
+//
+struct Span{
+  long start;
+  long length;
+};
+
+//
+// The covered pixels of a width x height pixmap as runs along the
+// scanlines. Work done through a mask, gathering and scattering included,
+// follows the runs, so it scales with the covered area.
+//
+class Mask{
+private:
+  std::vector<Span> runs;
+  long ncovered;
+
+  template<class Covered> void build(const Pixel *pixels, int width, int height, Covered covered);
+
+public:
+  Mask();
+
+  // every pixel covered
+  void full(int width, int height);
+  // covered where alpha is not 0
+  void fromalpha(const Pixel *pixels, int width, int height);
+  // covered where a mask image is at least half white
+  void fromimage(const Pixel *pixels, int width, int height);
+
+  long covered() const { return ncovered; }
+  const std::vector<Span> &spans() const { return runs; }
+
+  // copy the covered pixels into covered() contiguous pixels of out
+  void gather(const Pixel *pixels, Pixel *out) const;
+  // write the r, g and b of gathered pixels back to the covered pixels
+  void scatter(const Pixel *in, Pixel *pixels) const;
+};
+
+#endif
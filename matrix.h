@@ -4,6 +4,9 @@
 *   The code is based on previous code from D. House
 */
 
+#ifndef MATRIX_H
+#define MATRIX_H
+
 #include <cstdio>
 #include <cmath>
 
@@ -57,3 +60,5 @@ struct BilinearCoeffs{
 void setbilinear(double width, double height,
 		 Vector2D xycorners[4], BilinearCoeffs &coeff);
 void invbilinear(const BilinearCoeffs &c, Vector2D xy, Vector2D &uv);
+
+#endif
@@ -0,0 +1,224 @@
+/*
+*   Running lαβ statistics for images of any size
+*/
+
+#include "moments.h"
+
+#include <cstdio>
+#include <iostream>
+#include <fstream>
+#include <algorithm>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+using namespace std;
+
+void mergestats(LabStats &total, const LabStats &part){
+  if(part.count == 0)
+    return;
+  if(total.count == 0){
+    total = part;
+    return;
+  }
+
+  double count = total.count + part.count;
+  for(int c = 0; c < 3; c++){
+    double delta = part.mean[c] - total.mean[c];
+    total.mean[c] += delta * (part.count / count);
+    total.m2[c] += part.m2[c] + delta * delta * (total.count * part.count / count);
+  }
+  total.count = count;
+}
+
+/*
+   mergestats solved for the statistics of the rest. Cancellation grows
+   with every removal, so a total that parts are replaced in over and over
+   should be merged afresh from its parts now and then.
+*/
+void removestats(LabStats &total, const LabStats &part){
+  if(part.count == 0)
+    return;
+  double count = total.count - part.count;
+  if(count <= 0){
+    total.count = 0;
+    for(int c = 0; c < 3; c++)
+      total.mean[c] = total.m2[c] = 0;
+    return;
+  }
+
+  for(int c = 0; c < 3; c++){
+    double mean = (total.count * total.mean[c] - part.count * part.mean[c]) / count;
+    double delta = part.mean[c] - mean;
+    total.m2[c] = max(total.m2[c] - part.m2[c] - delta * delta * (count * part.count / total.count),
+                      0.0);
+    total.mean[c] = mean;
+  }
+  total.count = count;
+}
+
+const char *STATSFILEHEADER = "colortransfer-stats 1";
+
+bool writestatsfile(const string &filename, const string &kernel, const LabStats &stats){
+  FILE *file = fopen(filename.c_str(), "w");
+  if(!file){
+    cerr << "Could not write statistics to " << filename << endl;
+    return false;
+  }
+  fprintf(file, "%s\nkernel %s\ncount %.17g\n", STATSFILEHEADER, kernel.c_str(), stats.count);
+  fprintf(file, "mean %.17g %.17g %.17g\n", stats.mean[0], stats.mean[1], stats.mean[2]);
+  fprintf(file, "m2 %.17g %.17g %.17g\n", stats.m2[0], stats.m2[1], stats.m2[2]);
+  bool written = !ferror(file);
+  if(fclose(file) != 0 || !written){
+    cerr << "Could not write statistics to " << filename << endl;
+    return false;
+  }
+  return true;
+}
+
+bool readstatsfile(const string &filename, string &kernel, LabStats &stats){
+  ifstream file(filename.c_str());
+  string header, key[4];
+  getline(file, header);
+  file >> key[0] >> kernel >> key[1] >> stats.count
+       >> key[2] >> stats.mean[0] >> stats.mean[1] >> stats.mean[2]
+       >> key[3] >> stats.m2[0] >> stats.m2[1] >> stats.m2[2];
+  if(!file || header != STATSFILEHEADER || key[0] != "kernel" || key[1] != "count" ||
+     key[2] != "mean" || key[3] != "m2"){
+    cerr << "Could not read statistics from " << filename << endl;
+    return false;
+  }
+  return true;
+}
+
+LabMoments::LabMoments(){
+  clear();
+}
+
+void LabMoments::clear(){
+  total.count = 0;
+  for(int c = 0; c < 3; c++)
+    total.mean[c] = total.m2[c] = 0;
+}
+
+/*
+   Sum n interleaved values, or with Square their squares, LANES pixels side
+   by side, each less its shift in the matching entry of shift; then add the
+   lanes pairwise so that sums holds the total of each channel.
+*/
+template<bool Square>
+static void lanesums(const float *lab, int n, const float shift[], float sums[]){
+  const int width = 3 * LabMoments::LANES;
+  float lanes[width], shifts[width];
+  for(int j = 0; j < width; j++){
+    lanes[j] = 0;
+    shifts[j] = shift[j];
+  }
+
+  int whole = n - n % LabMoments::LANES;
+#ifdef __SSE2__
+  __m128 acc[width / 4], centre[width / 4];
+  for(int k = 0; k < width / 4; k++){
+    acc[k] = _mm_setzero_ps();
+    centre[k] = _mm_loadu_ps(shifts + 4 * k);
+  }
+  for(int i = 0; i < 3 * whole; i += width)
+    for(int k = 0; k < width / 4; k++){
+      __m128 d = _mm_sub_ps(_mm_loadu_ps(lab + i + 4 * k), centre[k]);
+      acc[k] = _mm_add_ps(acc[k], Square ? _mm_mul_ps(d, d) : d);
+    }
+  for(int k = 0; k < width / 4; k++)
+    _mm_storeu_ps(lanes + 4 * k, acc[k]);
+#else
+  for(int i = 0; i < 3 * whole; i += width)
+    for(int j = 0; j < width; j++){
+      float d = lab[i + j] - shifts[j];
+      lanes[j] += Square ? d * d : d;
+    }
+#endif
+  for(int j = 0; j < 3 * (n - whole); j++){
+    float d = lab[3 * whole + j] - shifts[j];
+    lanes[j] += Square ? d * d : d;
+  }
+
+  for(int half = width / 2; half >= 3; half /= 2)
+    for(int j = 0; j < half; j++)
+      lanes[j] += lanes[j + half];
+  for(int c = 0; c < 3; c++)
+    sums[c] = lanes[c];
+}
+
+/*
+   Mean of the block about a shift near the running mean, so that the float
+   sums stay small, then M2 about the block's own mean rounded to float, less
+   the exact correction for that rounding.
+*/
+void LabMoments::addblock(const float *lab, int n){
+  const int width = 3 * LANES;
+  float shift[width], sums[width];
+
+  for(int c = 0; c < 3; c++){
+    float s = total.count > 0 ? float(total.mean[c]) : lab[c];
+    for(int j = c; j < width; j += 3)
+      shift[j] = s;
+  }
+  LabStats block;
+  block.count = n;
+  lanesums<false>(lab, n, shift, sums);
+  for(int c = 0; c < 3; c++)
+    block.mean[c] = shift[c] + double(sums[c]) / n;
+
+  for(int c = 0; c < 3; c++)
+    for(int j = c; j < width; j += 3)
+      shift[j] = float(block.mean[c]);
+  lanesums<true>(lab, n, shift, sums);
+  for(int c = 0; c < 3; c++){
+    double rounding = block.mean[c] - shift[c];
+    block.m2[c] = max(double(sums[c]) - n * rounding * rounding, 0.0);
+  }
+
+  mergestats(total, block);
+}
+
+/*
+   Weighted blocks come from color tables, which are short, so they are
+   summed in double.
+*/
+void LabMoments::addblock(const float *lab, int n, const long *counts){
+  LabStats block;
+  double shift[3], sum[3] = {0, 0, 0};
+  for(int c = 0; c < 3; c++)
+    shift[c] = total.count > 0 ? total.mean[c] : lab[c];
+
+  block.count = 0;
+  for(int i = 0; i < n; i++){
+    double weight = double(counts[i]);
+    block.count += weight;
+    for(int c = 0; c < 3; c++)
+      sum[c] += weight * (lab[3 * i + c] - shift[c]);
+  }
+  if(block.count == 0)
+    return;
+
+  for(int c = 0; c < 3; c++){
+    block.mean[c] = shift[c] + sum[c] / block.count;
+    block.m2[c] = 0;
+  }
+  for(int i = 0; i < n; i++)
+    for(int c = 0; c < 3; c++){
+      double d = lab[3 * i + c] - block.mean[c];
+      block.m2[c] += double(counts[i]) * d * d;
+    }
+
+  mergestats(total, block);
+}
+
+void LabMoments::add(const float *lab, long n, const long *counts){
+  for(long start = 0; start < n; start += BLOCKPIXELS){
+    int count = int(min(long(BLOCKPIXELS), n - start));
+    if(counts)
+      addblock(lab + 3 * start, count, counts + start);
+    else
+      addblock(lab + 3 * start, count);
+  }
+}
@@ -0,0 +1,192 @@
+/*
+*   Pool of large buffers for images and their intermediates
+*/
+
+#include "pool.h"
+
+#include <cstdlib>
+#include <cstdint>
+#include <algorithm>
+#include <iterator>
+#include <new>
+#include <sys/mman.h>
+#include <unistd.h>
+
+using namespace std;
+
+size_t poolclassbytes(size_t bytes){
+  if(bytes < POOLMINBYTES)
+    return bytes;
+  size_t power = POOLMINBYTES;
+  while(power <= bytes / 2)
+    power *= 2;
+  size_t quarter = power / 4;
+  return (bytes + quarter - 1) / quarter * quarter;
+}
+
+// bytes mapped for a class: whole huge pages from POOLHUGEPAGE up, whole pages below
+static size_t mappedbytes(size_t classbytes){
+  size_t page = classbytes >= POOLHUGEPAGE ? POOLHUGEPAGE : size_t(sysconf(_SC_PAGESIZE));
+  return (classbytes + page - 1) / page * page;
+}
+
+/*
+   A huge page buffer is mapped a huge page longer than it needs and the
+   ends are unmapped, so that it starts on a huge page boundary.
+*/
+static void *mapblock(size_t bytes){
+  size_t extra = bytes >= POOLHUGEPAGE ? POOLHUGEPAGE : 0;
+  void *mapping = mmap(NULL, bytes + extra, PROT_READ | PROT_WRITE,
+                       MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if(mapping == MAP_FAILED)
+    return NULL;
+  char *data = static_cast<char *>(mapping);
+  if(extra > 0){
+    uintptr_t address = reinterpret_cast<uintptr_t>(mapping);
+    size_t head = (POOLHUGEPAGE - address % POOLHUGEPAGE) % POOLHUGEPAGE;
+    if(head > 0)
+      munmap(data, head);
+    if(extra - head > 0)
+      munmap(data + head + bytes, extra - head);
+    data += head;
+#ifdef MADV_HUGEPAGE
+    madvise(data, bytes, MADV_HUGEPAGE);
+#endif
+  }
+  return data;
+}
+
+/*
+   Buffers below POOLMINBYTES come from malloc with a header of
+   SMALLHEADER bytes, or twice that, before the data, whichever leaves the
+   data off a SMALLBOUNDARY; the last byte of the header holds its length.
+   Pooled buffers are mapped, so always start on one, and release tells
+   the two apart by the address alone, without taking the lock.
+*/
+const size_t SMALLHEADER = 16;
+const uintptr_t SMALLBOUNDARY = 4096;
+
+static void *allocatesmall(size_t bytes){
+  unsigned char *block = static_cast<unsigned char *>(malloc(bytes + 2 * SMALLHEADER));
+  if(!block)
+    throw bad_alloc();
+  size_t header = (reinterpret_cast<uintptr_t>(block) + SMALLHEADER) % SMALLBOUNDARY == 0 ?
+                  2 * SMALLHEADER : SMALLHEADER;
+  block[header - 1] = (unsigned char)header;
+  return block + header;
+}
+
+static bool issmall(const void *data){
+  return reinterpret_cast<uintptr_t>(data) % SMALLBOUNDARY != 0;
+}
+
+static void releasesmall(void *data){
+  unsigned char *bytes = static_cast<unsigned char *>(data);
+  ::free(bytes - bytes[-1]);
+}
+
+BufferPool::BufferPool(size_t c){
+  cap = c;
+  counts.requests = counts.hits = 0;
+  counts.retained = counts.inuse = counts.peakinuse = 0;
+  counts.mapped = counts.unmapped = 0;
+}
+
+BufferPool::~BufferPool(){
+  trim(0);
+}
+
+/*
+   The newest retained block of the class is taken, as its pages are the
+   likeliest to be in cache and still backed.
+*/
+void *BufferPool::allocate(size_t bytes){
+  if(bytes < POOLMINBYTES)
+    return allocatesmall(bytes);
+
+  size_t blockbytes = mappedbytes(poolclassbytes(bytes));
+  void *data = NULL;
+  {
+    lock_guard<mutex> guard(lock);
+    counts.requests++;
+    for(list<Block>::reverse_iterator b = spare.rbegin(); b != spare.rend(); ++b)
+      if(b->bytes == blockbytes){
+        data = b->data;
+        spare.erase(next(b).base());
+        counts.hits++;
+        counts.retained -= blockbytes;
+        break;
+      }
+    if(data){
+      used[data] = blockbytes;
+      counts.inuse += blockbytes;
+      counts.peakinuse = max(counts.peakinuse, counts.inuse);
+      return data;
+    }
+  }
+
+  data = mapblock(blockbytes);
+  if(!data)
+    throw bad_alloc();
+  lock_guard<mutex> guard(lock);
+  used[data] = blockbytes;
+  counts.mapped += blockbytes;
+  counts.inuse += blockbytes;
+  counts.peakinuse = max(counts.peakinuse, counts.inuse);
+  return data;
+}
+
+void BufferPool::release(void *data){
+  if(!data)
+    return;
+  if(issmall(data)){
+    releasesmall(data);
+    return;
+  }
+  lock_guard<mutex> guard(lock);
+  unordered_map<void *, size_t>::iterator u = used.find(data);
+  if(u == used.end())
+    return;
+  Block block = {data, u->second};
+  used.erase(u);
+  counts.inuse -= block.bytes;
+  if(block.bytes > cap){
+    munmap(block.data, block.bytes);
+    counts.unmapped += block.bytes;
+    return;
+  }
+  trim(cap - block.bytes);
+  spare.push_back(block);
+  counts.retained += block.bytes;
+}
+
+// return the oldest retained blocks to the system until at most limit bytes are left
+void BufferPool::trim(size_t limit){
+  while(counts.retained > limit && !spare.empty()){
+    Block &oldest = spare.front();
+    munmap(oldest.data, oldest.bytes);
+    counts.unmapped += oldest.bytes;
+    counts.retained -= oldest.bytes;
+    spare.pop_front();
+  }
+}
+
+void BufferPool::setcap(size_t c){
+  lock_guard<mutex> guard(lock);
+  cap = c;
+  trim(cap);
+}
+
+PoolStats BufferPool::stats(){
+  lock_guard<mutex> guard(lock);
+  return counts;
+}
+
+/*
+   Made on first use and never destroyed, so that buffers freed by threads
+   still running at exit find it.
+*/
+BufferPool &bufferpool(){
+  static BufferPool *pool = new BufferPool;
+  return *pool;
+}
@@ -0,0 +1,114 @@
+/*
+*   Pool of large buffers for images and their intermediates
+*
+*   Every transfer allocates pixmaps and lαβ arrays of tens to hundreds of
+*   megabytes, and a batch or a progressive preview does so over and over.
+*   Fresh memory from the system costs a page fault per page on first touch,
+*   and the heap fragments between jobs of different sizes. The pool keeps
+*   freed buffers of POOLMINBYTES or more, in size classes a quarter of a
+*   power of two apart, and hands them out again to requests of the same
+*   class. Buffers are mapped straight from the system, those of a huge page
+*   or more aligned to it and advised as huge pages where the system allows.
+*   Buffers that would take the bytes the pool retains over its cap are
+*   returned to the system, oldest first. Smaller requests go to malloc,
+*   and are freed without taking the pool's lock.
+*/
+
+#ifndef POOL_H
+#define POOL_H
+
+#include <cstddef>
+#include <list>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+const size_t POOLMINBYTES = 1 << 16;    // smaller buffers are not pooled
+const size_t POOLHUGEPAGE = 1 << 21;    // buffers of this size or more use huge pages
+const size_t POOLDEFAULTCAP = size_t(1) << 30;   // bytes a pool retains by default
+
+//
+// Counts since the pool was made. A hit is a request served from the
+// retained buffers; retained is the bytes held for reuse, and inuse and
+// peakinuse those handed out.
+//
+struct PoolStats{
+  long requests, hits;
+  size_t retained, inuse, peakinuse;
+  size_t mapped, unmapped;   // bytes taken from and returned to the system
+};
+
+class BufferPool{
+private:
+  struct Block{
+    void *data;
+    size_t bytes;   // of the size class, as mapped
+  };
+
+  std::mutex lock;
+  size_t cap;
+  std::list<Block> spare;                       // retained, oldest first
+  std::unordered_map<void *, size_t> used;      // pooled buffers handed out, and their bytes
+  PoolStats counts;
+
+  void trim(size_t limit);
+
+public:
+  BufferPool(size_t cap = POOLDEFAULTCAP);
+  ~BufferPool();
+
+  // At least bytes of memory, which may hold anything left by earlier use
+  void *allocate(size_t bytes);
+  // Return memory from allocate, or NULL
+  void release(void *data);
+
+  // Retain at most cap bytes, returning the oldest buffers over it to the system now
+  void setcap(size_t cap);
+  PoolStats stats();
+};
+
+// the pool of the process, which the library's image buffers come from
+BufferPool &bufferpool();
+
+// size of the class a request of bytes falls in
+size_t poolclassbytes(size_t bytes);
+
+//
+// Arrays of n plain values from bufferpool(), not initialized, freed with
+// poolfree. The library's pixmaps, readpixmap and scalepixmap included,
+// are made this way.
+//
+template<class T>
+T *poolnew(long n){
+  return static_cast<T *>(bufferpool().allocate(sizeof(T) * size_t(n > 0 ? n : 1)));
+}
+
+template<class T>
+void poolfree(T *data){
+  bufferpool().release(data);
+}
+
+//
+// Allocator for vectors of plain values from bufferpool(). Resizing a
+// vector still initializes its values.
+//
+template<class T>
+struct PoolAllocator{
+  typedef T value_type;
+
+  PoolAllocator(){}
+  template<class U> PoolAllocator(const PoolAllocator<U> &){}
+
+  T *allocate(size_t n){ return static_cast<T *>(bufferpool().allocate(sizeof(T) * n)); }
+  void deallocate(T *data, size_t){ bufferpool().release(data); }
+};
+
+template<class T, class U>
+bool operator==(const PoolAllocator<T> &, const PoolAllocator<U> &){ return true; }
+template<class T, class U>
+bool operator!=(const PoolAllocator<T> &, const PoolAllocator<U> &){ return false; }
+
+template<class T>
+using PoolVector = std::vector<T, PoolAllocator<T> >;
+
+#endif
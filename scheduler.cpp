@@ -0,0 +1,227 @@
+/*
+*   Work-stealing scheduler for batches of jobs of very different sizes
+*/
+
+#include "scheduler.h"
+
+#include <thread>
+#include <algorithm>
+
+using namespace std;
+
+// the scheduler and worker the calling thread belongs to, if any
+static thread_local const TaskScheduler *CurrentScheduler = NULL;
+static thread_local int CurrentWorker = 0;
+
+TaskScheduler::TaskScheduler(int n){
+  nthreads = max(n, 1);
+  for(int t = 0; t < nthreads; t++)
+    workers.push_back(unique_ptr<Worker>(new Worker));
+  pending = 0;
+  nextjob = 0;
+  njobs = 0;
+  wakeups = 0;
+}
+
+/*
+   Wake the idle workers. The count changes under the lock, so a worker
+   about to sleep sees any wakeup after it last looked for work.
+*/
+void TaskScheduler::wake(bool all){
+  {
+    lock_guard<mutex> lock(idlelock);
+    wakeups++;
+  }
+  if(all)
+    idle.notify_all();
+  else
+    idle.notify_one();
+}
+
+void TaskScheduler::spawn(const Task &task){
+  int index = CurrentScheduler == this ? CurrentWorker : 0;
+  pending++;
+  {
+    lock_guard<mutex> lock(workers[index]->lock);
+    workers[index]->tasks.push_back(task);
+  }
+  wake(false);
+}
+
+/*
+   The newest task of the worker's own deque, so that it goes on with the
+   job it is working on.
+*/
+bool TaskScheduler::pop(int index, Task &task){
+  lock_guard<mutex> lock(workers[index]->lock);
+  if(workers[index]->tasks.empty())
+    return false;
+  task = workers[index]->tasks.back();
+  workers[index]->tasks.pop_back();
+  return true;
+}
+
+/*
+   The oldest task of the next worker round from this one that has any.
+   The oldest tasks belong to the jobs started first.
+*/
+bool TaskScheduler::steal(int index, Task &task){
+  for(int k = 1; k < nthreads; k++){
+    Worker &victim = *workers[(index + k) % nthreads];
+    lock_guard<mutex> lock(victim.lock);
+    if(!victim.tasks.empty()){
+      task = victim.tasks.front();
+      victim.tasks.pop_front();
+      return true;
+    }
+  }
+  return false;
+}
+
+/*
+   Run tasks, stolen ones included, and start a new job only when there are
+   none. A job being started counts as pending, so that no worker leaves
+   while it may still spawn tasks. An idle worker sleeps until a task is
+   spawned or the last pending work finishes.
+*/
+void TaskScheduler::work(int index){
+  CurrentScheduler = this;
+  CurrentWorker = index;
+
+  for(;;){
+    long seen;
+    {
+      lock_guard<mutex> lock(idlelock);
+      seen = wakeups;
+    }
+    Task task;
+    if(pop(index, task) || steal(index, task)){
+      task();
+      task = Task();
+      pending--;
+      continue;
+    }
+
+    pending++;
+    long job = nextjob++;
+    if(job < njobs){
+      startjob(job);
+      pending--;
+      continue;
+    }
+    if(--pending == 0){
+      wake(true);
+      break;
+    }
+
+    unique_lock<mutex> lock(idlelock);
+    idle.wait(lock, [&](){ return wakeups != seen; });
+  }
+
+  CurrentScheduler = NULL;
+}
+
+/*
+   Threads kept for parallelpieces, made as calls first need them and never
+   ended, each running helpers from a shared queue. It is never freed, so
+   that the threads can outlive the statics at exit.
+*/
+struct PiecePool{
+  mutex lock;
+  condition_variable ready;
+  deque<function<void()> > helpers;
+  int nthreads;
+
+  PiecePool(): nthreads(0) {}
+
+  void work(){
+    for(;;){
+      function<void()> helper;
+      {
+        unique_lock<mutex> guard(lock);
+        ready.wait(guard, [this](){ return !helpers.empty(); });
+        helper = helpers.front();
+        helpers.pop_front();
+      }
+      helper();
+    }
+  }
+
+  void add(int nhelpers, const function<void()> &helper){
+    {
+      lock_guard<mutex> guard(lock);
+      for(int t = 0; t < nhelpers; t++)
+        helpers.push_back(helper);
+      for(; nthreads < nhelpers; nthreads++)
+        thread(&PiecePool::work, this).detach();
+    }
+    ready.notify_all();
+  }
+};
+
+static PiecePool &piecepool(){
+  static PiecePool *pool = new PiecePool;
+  return *pool;
+}
+
+/*
+   The state of one call, shared with its helpers. The caller takes pieces
+   too and, once they are all taken, closes the call and waits only for
+   the helpers already in it; one that starts later finds it closed.
+*/
+struct PieceCall{
+  long total, piece, pieces;
+  const function<void(long, long)> *body;
+  atomic<long> next;
+  mutex lock;
+  condition_variable done;
+  bool closed;
+  int active;
+
+  PieceCall(long t, long p, const function<void(long, long)> &b)
+    : total(t), piece(max(p, 1L)), pieces((total + piece - 1) / piece), body(&b),
+      next(0), closed(false), active(0) {}
+
+  void work(){
+    for(long k = next++; k < pieces; k = next++)
+      (*body)(k * piece, min(piece, total - k * piece));
+  }
+
+  void help(){
+    {
+      lock_guard<mutex> guard(lock);
+      if(closed)
+        return;
+      active++;
+    }
+    work();
+    lock_guard<mutex> guard(lock);
+    if(--active == 0)
+      done.notify_all();
+  }
+};
+
+void parallelpieces(long total, long piece, int nthreads, const function<void(long, long)> &body){
+  shared_ptr<PieceCall> call(new PieceCall(total, piece, body));
+  long nhelpers = min(long(nthreads), call->pieces) - 1;
+  if(nhelpers > 0)
+    piecepool().add(int(nhelpers), [call](){ call->help(); });
+  call->work();
+
+  unique_lock<mutex> guard(call->lock);
+  call->closed = true;
+  call->done.wait(guard, [&](){ return call->active == 0; });
+}
+
+void TaskScheduler::run(long n, const function<void(long)> &start){
+  njobs = n;
+  nextjob = 0;
+  startjob = start;
+
+  vector<thread> threads;
+  for(int t = 1; t < nthreads; t++)
+    threads.push_back(thread(&TaskScheduler::work, this, t));
+  work(0);
+  for(size_t t = 0; t < threads.size(); t++)
+    threads[t].join();
+}
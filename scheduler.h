@@ -0,0 +1,75 @@
+/*
+*   Work-stealing scheduler for batches of jobs of very different sizes
+*
+*   A job is started by a function that runs its first stage and spawns
+*   tasks for the rest; a task may spawn more, as when a large image's
+*   statistics or apply are split into pieces, and the task that finishes
+*   the last piece spawns the next stage. Each worker keeps its tasks in a
+*   deque, running the newest first, and an idle worker steals the oldest
+*   task of another. A new job is only started by a worker that finds no
+*   task to run or steal, so jobs already in flight are finished first and
+*   memory holds about as many jobs as there are workers: a small image runs
+*   whole on the worker that started it, while the pieces of a large one
+*   spread over the workers that would otherwise be idle.
+*/
+
+#ifndef SCHEDULER_H
+#define SCHEDULER_H
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+class TaskScheduler{
+public:
+  typedef std::function<void()> Task;
+
+private:
+  struct Worker{
+    std::mutex lock;
+    std::deque<Task> tasks;
+  };
+
+  int nthreads;
+  std::vector<std::unique_ptr<Worker> > workers;
+  std::atomic<long> pending;    // tasks spawned, and jobs being started, not yet finished
+  std::atomic<long> nextjob;
+  long njobs;
+  std::function<void(long)> startjob;
+
+  std::mutex idlelock;
+  std::condition_variable idle;
+  long wakeups;                 // counts spawns and the end of the work, under idlelock
+
+  bool pop(int index, Task &task);
+  bool steal(int index, Task &task);
+  void work(int index);
+  void wake(bool all);
+
+public:
+  TaskScheduler(int nthreads);
+
+  //
+  // Start jobs 0 to njobs - 1 with start on nthreads workers, and return
+  // once every job has been started and every task has run.
+  //
+  void run(long njobs, const std::function<void(long)> &start);
+
+  // Queue a task; from a worker of this scheduler it goes to that worker
+  void spawn(const Task &task);
+};
+
+//
+// Call body(start, n) for pieces of at most piece of 0 to total - 1, on
+// nthreads threads, the calling one included, for loops over independent
+// pixels. The other threads are kept between calls rather than made for
+// each, and calls may come from several threads or from within a body.
+//
+void parallelpieces(long total, long piece, int nthreads,
+                    const std::function<void(long, long)> &body);
+
+#endif
@@ -0,0 +1,789 @@
+/*
+*   Color transfer kernels and the ColorTransfer object
+*/
+
+#include "transfer.h"
+#include "matrix.h"
+#include "fastmath.h"
+#include "uniquecolors.h"
+#include "mask.h"
+#include "moments.h"
+#include "fixedpoint.h"
+#include "colorspace.h"
+
+#include <cmath>
+#include <algorithm>
+
+using namespace std;
+
+const double RGBTOLMS[3][3] = {
+  {0.3811, 0.5783, 0.0402},
+  {0.1967, 0.7244, 0.0782},
+  {0.0241, 0.1288, 0.8444}
+};
+
+const double LMSTORGB[3][3] = {
+  {4.4679, -3.5873, 0.1193},
+  {-1.2186, 2.3809, -0.1624},
+  {0.0497, -0.2439, 1.2045}
+};
+
+/*
+   The original transfer, kept as the accuracy reference for every other
+   kernel. Do not optimize this routine.
+*/
+void referencetransfer(const Pixel *source, long nsource,
+                       const Pixel *dest, Pixel *result, long ndest){
+  double rgbToLms[3][3];
+  rgbToLms[0][0] = 0.3811;
+  rgbToLms[0][1] = 0.5783;
+  rgbToLms[0][2] = 0.0402;
+  rgbToLms[1][0] = 0.1967;
+  rgbToLms[1][1] = 0.7244;
+  rgbToLms[1][2] = 0.0782;
+  rgbToLms[2][0] = 0.0241;
+  rgbToLms[2][1] = 0.1288;
+  rgbToLms[2][2] = 0.8444;
+
+  Matrix3D rgbToLmsMatrix(rgbToLms);
+
+  double lmsToLab1[3][3];
+  lmsToLab1[0][0] = lmsToLab1[0][1] = lmsToLab1[0][2] = 1;
+  lmsToLab1[1][0] = lmsToLab1[1][1] = 1;
+  lmsToLab1[1][2] = -2;
+  lmsToLab1[2][0] = 1;
+  lmsToLab1[2][1] = -1;
+  lmsToLab1[2][2] = 0;
+
+  double lmsToLab2[3][3];
+  lmsToLab2[0][0] = 1 / sqrt(3);
+  lmsToLab2[0][1] = lmsToLab2[0][2] = lmsToLab2[1][0] = 0;
+  lmsToLab2[1][1] = 1 / sqrt(6);
+  lmsToLab2[1][2] = lmsToLab2[2][0] = lmsToLab2[2][1] = 0;
+  lmsToLab2[2][2] = 1 / sqrt(2);
+
+  Matrix3D lmsToLab1Matrix(lmsToLab1);
+  Matrix3D lmsToLab2Matrix(lmsToLab2);
+
+  PoolVector<Vector3D> sourceLabArray(nsource);
+  PoolVector<Vector3D> destLabArray(ndest);
+
+  //Convert RGB to LMS
+  for(long i = 0; i < nsource; i++) {
+    Vector3D sourceRGB(max(double(source[i].r)/255, 1.0/255),
+      max(double(source[i].g)/255, 1.0/255),
+      max(double(source[i].b)/255, 1.0/255));
+    Vector3D sourceLMS = rgbToLmsMatrix * sourceRGB;
+    //convert to log scale
+    sourceLMS.x = log10(sourceLMS.x);
+    sourceLMS.y = log10(sourceLMS.y);
+    sourceLMS.z = log10(sourceLMS.z);
+
+    //Convert from LMS to lαβ
+    Matrix3D sourceLmsToLabM = lmsToLab2Matrix * lmsToLab1Matrix;
+    sourceLabArray[i] = sourceLmsToLabM * sourceLMS;
+  }
+
+  for(long i = 0; i < ndest; i++) {
+    Vector3D destRGB(max(double(dest[i].r)/255, 1.0/255),
+      max(double(dest[i].g)/255, 1.0/255),
+      max(double(dest[i].b)/255, 1.0/255));
+    Vector3D destLMS = rgbToLmsMatrix * destRGB;
+
+    //convert to log scale
+    destLMS.x = log10(destLMS.x);
+    destLMS.y = log10(destLMS.y);
+    destLMS.z = log10(destLMS.z);
+
+    //Convert from LMS to lαβ
+    Matrix3D destLmsToLabM = lmsToLab2Matrix * lmsToLab1Matrix;
+    destLabArray[i] = destLmsToLabM * destLMS;
+  }
+
+  //Calculate mean values for l, α, and β source and destination images
+  double sourceSumL = 0, sourceSumA = 0, sourceSumB = 0;
+  double destSumL = 0, destSumA = 0, destSumB = 0;
+
+  for(long i = 0; i < nsource; i++) {
+    sourceSumL += sourceLabArray[i].x;
+    sourceSumA += sourceLabArray[i].y;
+    sourceSumB += sourceLabArray[i].z;
+  }
+  for(long i = 0; i < ndest; i++) {
+    destSumL += destLabArray[i].x;
+    destSumA += destLabArray[i].y;
+    destSumB += destLabArray[i].z;
+  }
+
+  double sourceTotal = double(nsource);
+  double destTotal = double(ndest);
+
+  double sourceMeanL = sourceSumL / sourceTotal;
+  double sourceMeanA = sourceSumA / sourceTotal;
+  double sourceMeanB = sourceSumB / sourceTotal;
+
+  double destMeanL = destSumL / destTotal;
+  double destMeanA = destSumA / destTotal;
+  double destMeanB = destSumB / destTotal;
+
+  //Calculate standard deviation for l, α, and β source and destination images
+  double sourceVarianceL = 0, sourceVarianceA = 0, sourceVarianceB = 0;
+  double destVarianceL = 0, destVarianceA = 0, destVarianceB = 0;
+
+  for(long i = 0; i < nsource; i++) {
+    sourceVarianceL += pow(sourceLabArray[i].x - sourceMeanL, 2);
+    sourceVarianceA += pow(sourceLabArray[i].y - sourceMeanA, 2);
+    sourceVarianceB += pow(sourceLabArray[i].z - sourceMeanB, 2);
+  }
+  for(long i = 0; i < ndest; i++) {
+    destVarianceL += pow(destLabArray[i].x - destMeanL, 2);
+    destVarianceA += pow(destLabArray[i].y - destMeanA, 2);
+    destVarianceB += pow(destLabArray[i].z - destMeanB, 2);
+  }
+
+  double sourceStdL = sqrt(sourceVarianceL / sourceTotal);
+  double sourceStdA = sqrt(sourceVarianceA / sourceTotal);
+  double sourceStdB = sqrt(sourceVarianceB / sourceTotal);
+
+  double destStdL = sqrt(destVarianceL / destTotal);
+  double destStdA = sqrt(destVarianceA / destTotal);
+  double destStdB = sqrt(destVarianceB / destTotal);
+
+  //Calculate ratio standard deviations
+  double ratioStdL = sourceStdL / destStdL;
+  double ratioStdA = sourceStdA / destStdA;
+  double ratioStdB = sourceStdB / destStdB;
+
+  //Calculate new data for destination lαβ
+  for(long i = 0; i < ndest; i++) {
+    destLabArray[i].x -= destMeanL;
+    destLabArray[i].x *= ratioStdL;
+    destLabArray[i].x += sourceMeanL;
+
+    destLabArray[i].y -= destMeanA;
+    destLabArray[i].y *= ratioStdA;
+    destLabArray[i].y += sourceMeanA;
+
+    destLabArray[i].z -= destMeanB;
+    destLabArray[i].z *= ratioStdB;
+    destLabArray[i].z += sourceMeanB;
+  }
+
+  //Convert lαβ to LMS
+  double labToLms1[3][3];
+  labToLms1[0][0] = sqrt(3) / 3;
+  labToLms1[0][1] = labToLms1[0][2] = labToLms1[1][0] = 0;
+  labToLms1[1][1] = sqrt(6) / 6;
+  labToLms1[1][2] = labToLms1[2][0] = labToLms1[2][1] = 0;
+  labToLms1[2][2] = sqrt(2) / 2;
+
+  double labToLms2[3][3];
+  labToLms2[0][0] = labToLms2[0][1] = labToLms2[0][2] = 1;
+  labToLms2[1][0] = labToLms2[1][1] = 1;
+  labToLms2[1][2] = -1;
+  labToLms2[2][0] = 1;
+  labToLms2[2][1] = -2;
+  labToLms2[2][2] = 0;
+
+  Matrix3D labToLms1Matrix(labToLms1);
+  Matrix3D labToLms2Matrix(labToLms2);
+
+  //Convert from LMS to RGB
+  double lmsToRgb[3][3];
+  lmsToRgb[0][0] = 4.4679;
+  lmsToRgb[0][1] = -3.5873;
+  lmsToRgb[0][2] = 0.1193;
+  lmsToRgb[1][0] = -1.2186;
+  lmsToRgb[1][1] = 2.3809;
+  lmsToRgb[1][2] = -0.1624;
+  lmsToRgb[2][0] = 0.0497;
+  lmsToRgb[2][1] = -0.2439;
+  lmsToRgb[2][2] = 1.2045;
+
+  Matrix3D lmsToRgbMatrix(lmsToRgb);
+
+  PoolVector<Vector3D> destRGBArray(ndest);
+
+  for(long i = 0; i < ndest; i++) {
+    Matrix3D labToLmsM = labToLms2Matrix * labToLms1Matrix;
+    destLabArray[i] = labToLmsM * destLabArray[i];
+
+    //Convert back to linear space
+    destLabArray[i].x = pow(10, destLabArray[i].x);
+    destLabArray[i].y = pow(10, destLabArray[i].y);
+    destLabArray[i].z = pow(10, destLabArray[i].z);
+
+    //Convert LMS back to RGB
+    destRGBArray[i] = lmsToRgbMatrix * destLabArray[i];
+  }
+
+  for(long i = 0; i < ndest; i++) {
+    result[i].r = min(abs(destRGBArray[i].x * 255), float(255));
+    result[i].g = min(abs(destRGBArray[i].y * 255), float(255));
+    result[i].b = min(abs(destRGBArray[i].z * 255), float(255));
+  }
+}
+
+/*
+   Convert a single pixel to lαβ in double precision with the reference
+   matrices. Used to measure the error of the other kernels.
+*/
+void referencelab(const Pixel &p, double lab[3]){
+  double rgb[3] = {max(double(p.r), 1.0) / 255, max(double(p.g), 1.0) / 255,
+                   max(double(p.b), 1.0) / 255};
+  double lms[3];
+  for(int row = 0; row < 3; row++)
+    lms[row] = log10(RGBTOLMS[row][0] * rgb[0] + RGBTOLMS[row][1] * rgb[1] +
+                     RGBTOLMS[row][2] * rgb[2]);
+  lab[0] = (lms[0] + lms[1] + lms[2]) / sqrt(3);
+  lab[1] = (lms[0] + lms[1] - 2 * lms[2]) / sqrt(6);
+  lab[2] = (lms[0] - lms[1]) / sqrt(2);
+}
+
+//
+// The reference kernel split into the two library stages. Every operation
+// is the one referencetransfer performs, in the same precision, so the
+// result is the same to the bit.
+//
+static const double LMSTOLAB1[3][3] = {{1, 1, 1}, {1, 1, -2}, {1, -1, 0}};
+static const double LMSTOLAB2[3][3] = {{1 / sqrt(3), 0, 0}, {0, 1 / sqrt(6), 0},
+                                       {0, 0, 1 / sqrt(2)}};
+static const double LABTOLMS1[3][3] = {{sqrt(3) / 3, 0, 0}, {0, sqrt(6) / 6, 0},
+                                       {0, 0, sqrt(2) / 2}};
+static const double LABTOLMS2[3][3] = {{1, 1, 1}, {1, 1, -1}, {1, -2, 0}};
+
+// the matrices are built in place, as Matrix3D has no assignment of its own
+struct ReferenceMatrices{
+  Matrix3D rgbtolms, lmstolab, labtolms, lmstorgb;
+
+  ReferenceMatrices():
+    rgbtolms(RGBTOLMS), lmstolab(Matrix3D(LMSTOLAB2) * Matrix3D(LMSTOLAB1)),
+    labtolms(Matrix3D(LABTOLMS2) * Matrix3D(LABTOLMS1)), lmstorgb(LMSTORGB) {}
+};
+
+static Vector3D referencepixellab(const Pixel &p, const ReferenceMatrices &m){
+  Vector3D rgb(max(double(p.r)/255, 1.0/255),
+    max(double(p.g)/255, 1.0/255),
+    max(double(p.b)/255, 1.0/255));
+  Vector3D lms = m.rgbtolms * rgb;
+  lms.x = log10(lms.x);
+  lms.y = log10(lms.y);
+  lms.z = log10(lms.z);
+  return m.lmstolab * lms;
+}
+
+/*
+   Means of the lαβ of n pixels, then the squared differences from them in
+   a second pass, as the reference does. lab(i) returns the lαβ of pixel i.
+*/
+template<class LabOf>
+static void referencemoments(long n, const LabOf &lab, LabStats &stats){
+  double sum[3] = {0, 0, 0};
+  for(long i = 0; i < n; i++){
+    Vector3D v = lab(i);
+    sum[0] += v.x;
+    sum[1] += v.y;
+    sum[2] += v.z;
+  }
+
+  stats.count = double(n);
+  for(int c = 0; c < 3; c++){
+    stats.mean[c] = sum[c] / stats.count;
+    stats.m2[c] = 0;
+  }
+
+  for(long i = 0; i < n; i++){
+    Vector3D v = lab(i);
+    stats.m2[0] += pow(v.x - stats.mean[0], 2);
+    stats.m2[1] += pow(v.y - stats.mean[1], 2);
+    stats.m2[2] += pow(v.z - stats.mean[2], 2);
+  }
+}
+
+/*
+   Move one lαβ value from the dest to the source statistics and convert it
+   back to RGB in result.
+*/
+static void referencemove(Vector3D lab, const LabStats &source, const LabStats &dest,
+                          const double ratio[3], const ReferenceMatrices &m, Pixel &result){
+  lab.x -= dest.mean[0];
+  lab.x *= ratio[0];
+  lab.x += source.mean[0];
+  lab.y -= dest.mean[1];
+  lab.y *= ratio[1];
+  lab.y += source.mean[1];
+  lab.z -= dest.mean[2];
+  lab.z *= ratio[2];
+  lab.z += source.mean[2];
+
+  Vector3D lms = m.labtolms * lab;
+  lms.x = pow(10, lms.x);
+  lms.y = pow(10, lms.y);
+  lms.z = pow(10, lms.z);
+  Vector3D rgb = m.lmstorgb * lms;
+
+  result.r = min(abs(rgb.x * 255), float(255));
+  result.g = min(abs(rgb.y * 255), float(255));
+  result.b = min(abs(rgb.z * 255), float(255));
+}
+
+struct PixelLab{
+  const Pixel *pixels;
+  const ReferenceMatrices &m;
+  Vector3D operator()(long i) const { return referencepixellab(pixels[i], m); }
+};
+
+struct StoredLab{
+  const float *lab;
+  Vector3D operator()(long i) const { return Vector3D(lab[3 * i], lab[3 * i + 1], lab[3 * i + 2]); }
+};
+
+static void referencestats(const Pixel *pixels, long n, LabStats &stats){
+  ReferenceMatrices m;
+  PixelLab lab = {pixels, m};
+  referencemoments(n, lab, stats);
+}
+
+static void referenceapply(const LabStats &source, const LabStats &dest,
+                           const Pixel *pixels, Pixel *result, long n){
+  ReferenceMatrices m;
+
+  double ratio[3];
+  for(int c = 0; c < 3; c++)
+    ratio[c] = labstddev(source, c) / labstddev(dest, c);
+
+  for(long i = 0; i < n; i++)
+    referencemove(referencepixellab(pixels[i], m), source, dest, ratio, m, result[i]);
+}
+
+/*
+   The lαβ of the reference is stored in float, so keeping it in a LabImage
+   loses nothing.
+*/
+static void referenceconvert(const Pixel *pixels, long n, LabImage &image){
+  ReferenceMatrices m;
+
+  image.lab.resize(3 * n);
+  image.indices.clear();
+  for(long i = 0; i < n; i++){
+    Vector3D lab = referencepixellab(pixels[i], m);
+    image.lab[3 * i] = lab.x;
+    image.lab[3 * i + 1] = lab.y;
+    image.lab[3 * i + 2] = lab.z;
+  }
+  StoredLab lab = {image.lab.data()};
+  referencemoments(n, lab, image.stats);
+}
+
+static void referenceapplyimage(const LabStats &source, const LabImage &dest,
+                                long start, long n, Pixel *result){
+  ReferenceMatrices m;
+
+  double ratio[3];
+  for(int c = 0; c < 3; c++)
+    ratio[c] = labstddev(source, c) / labstddev(dest.stats, c);
+
+  const float *lab = dest.lab.data() + 3 * start;
+  for(long i = 0; i < n; i++)
+    referencemove(Vector3D(lab[3 * i], lab[3 * i + 1], lab[3 * i + 2]), source, dest.stats,
+                  ratio, m, result[i]);
+}
+
+//
+// Math policies for the single-precision kernels: float libm, or the
+// fastmath.h approximations at precision P. Both work on whole arrays so
+// that the fast forms run four pixels at a time.
+//
+struct LibmMath{
+  static void log10(const float *in, float *out, long n){
+    for(long i = 0; i < n; i++)
+      out[i] = log10f(in[i]);
+  }
+  static void exp10(const float *in, float *out, long n){
+    for(long i = 0; i < n; i++)
+      out[i] = powf(10.0f, in[i]);
+  }
+};
+
+template<int P>
+struct FastMath{
+  static void log10(const float *in, float *out, long n) { fastlog10<P>(in, out, n); }
+  static void exp10(const float *in, float *out, long n) { fastexp10<P>(in, out, n); }
+};
+
+const int BLOCK = COLORBLOCK;   // pixels handed to the math policy at a time
+
+//
+// The single-precision conversions for a color space of colorspace.h, as
+// used by the kernel stages below: lab converts n <= BLOCK pixels to
+// interleaved values of the space, and apply moves n such values by scale
+// and offset and converts them back to RGB in result. Any other pipeline
+// with the same lab and apply members, such as FixedPipeline, can be used
+// in their place.
+//
+template<class Space>
+struct SpacePipeline{
+  Space space;
+
+  void lab(const Pixel *pixels, int n, float *lab) const{
+    float planes[3 * BLOCK];
+    space.forward(pixels, n, planes);
+    for(int i = 0; i < n; i++)
+      for(int c = 0; c < 3; c++)
+        lab[3 * i + c] = planes[c * n + i];
+  }
+
+  void apply(const float *lab, int n, const float scale[3], const float offset[3],
+             Pixel *result) const{
+    float planes[3 * BLOCK];
+    for(int i = 0; i < n; i++)
+      for(int c = 0; c < 3; c++)
+        planes[c * n + i] = lab[3 * i + c] * scale[c] + offset[c];
+    space.inverse(planes, n);
+
+    for(int i = 0; i < n; i++){
+      result[i].r = min(fabsf(planes[i] * 255), 255.0f);
+      result[i].g = min(fabsf(planes[n + i] * 255), 255.0f);
+      result[i].b = min(fabsf(planes[2 * n + i] * 255), 255.0f);
+    }
+  }
+};
+
+// The lαβ kernels
+template<class Math>
+struct FloatPipeline : SpacePipeline<LabSpace<Math> > {};
+
+/*
+   Per channel scale and offset taking destination lαβ to the source
+   statistics.
+*/
+static void transfercoefficients(const LabStats &source, const LabStats &dest,
+                                 float scale[3], float offset[3]){
+  for(int c = 0; c < 3; c++){
+    scale[c] = labstddev(source, c) / labstddev(dest, c);
+    offset[c] = source.mean[c] - scale[c] * dest.mean[c];
+  }
+}
+
+/*
+   Convert the n colors of a table, or n pixels, to interleaved lαβ in lab,
+   accumulating the moments as they go. With a table the moments are
+   weighted by the color counts; the lαβ of a color is the same either way.
+*/
+template<class Pipeline>
+static void convertmoments(const Pixel *pixels, long n, const long *counts, const Pipeline &p,
+                           float *lab, LabMoments &moments){
+  for(long start = 0; start < n; start += BLOCK){
+    int count = int(min(long(BLOCK), n - start));
+    p.lab(pixels + start, count, lab + 3 * start);
+    moments.add(lab + 3 * start, count, counts ? counts + start : NULL);
+  }
+}
+
+// Counting colors only pays off with fewer than one color per 8 pixels
+const double UNIQUEFRACTION = 0.125;
+
+/*
+   Statistics stage of the single-precision kernels: combined matrices, the
+   math policy's log10, and a single pass for the moments (moments.h). With Unique,
+   images with few enough distinct colors get their moments from the color
+   table.
+*/
+template<class Pipeline, bool Unique>
+static void labstats(const Pixel *pixels, long n, LabStats &stats){
+  Pipeline p;
+
+  LabMoments moments;
+  float lab[3 * BLOCK];
+  UniqueColors table;
+  bool unique = Unique && table.add(pixels, n, NULL, UNIQUEFRACTION);
+  const Pixel *colors = unique ? table.colors() : pixels;
+  long ncolors = unique ? table.size() : n;
+  const long *counts = unique ? table.colorcounts() : NULL;
+
+  for(long start = 0; start < ncolors; start += BLOCK){
+    int count = int(min(long(BLOCK), ncolors - start));
+    p.lab(colors + start, count, lab);
+    moments.add(lab, count, counts ? counts + start : NULL);
+  }
+  stats = moments.stats();
+}
+
+/*
+   Map ncolors lαβ values through scale and offset into mapped, then gather
+   the result of each of the n pixels by its palette index.
+*/
+template<class Pipeline>
+static void applypalette(const float *lab, long ncolors, const uint32_t *indices, long n,
+                         const float scale[3], const float offset[3], const Pipeline &p,
+                         Pixel *result){
+  Pixel *mapped = poolnew<Pixel>(ncolors);
+  for(long start = 0; start < ncolors; start += BLOCK){
+    int count = int(min(long(BLOCK), ncolors - start));
+    p.apply(lab + 3 * start, count, scale, offset, mapped + start);
+  }
+  for(long i = 0; i < n; i++){
+    const Pixel &p = mapped[indices[i]];
+    result[i].r = p.r;
+    result[i].g = p.g;
+    result[i].b = p.b;
+  }
+  poolfree(mapped);
+}
+
+/*
+   Apply stage of the single-precision kernels. Each block of pixels is
+   converted to lαβ, moved and converted back while it is in cache. With
+   Unique, images with few enough distinct colors are mapped one distinct
+   color at a time and the result gathered by palette index.
+*/
+template<class Pipeline, bool Unique>
+static void labapply(const LabStats &source, const LabStats &dest,
+                     const Pixel *pixels, Pixel *result, long n){
+  Pipeline p;
+  float scale[3], offset[3];
+  transfercoefficients(source, dest, scale, offset);
+
+  if(Unique){
+    UniqueColors table;
+    uint32_t *indices = poolnew<uint32_t>(n);
+    if(table.add(pixels, n, indices, UNIQUEFRACTION)){
+      long ncolors = table.size();
+      float *lab = poolnew<float>(3 * ncolors);
+      for(long start = 0; start < ncolors; start += BLOCK){
+        int count = int(min(long(BLOCK), ncolors - start));
+        p.lab(table.colors() + start, count, lab + 3 * start);
+      }
+      applypalette(lab, ncolors, indices, n, scale, offset, p, result);
+      poolfree(lab);
+      poolfree(indices);
+      return;
+    }
+    poolfree(indices);
+  }
+
+  float lab[3 * BLOCK];
+  for(long start = 0; start < n; start += BLOCK){
+    int count = int(min(long(BLOCK), n - start));
+    p.lab(pixels + start, count, lab);
+    p.apply(lab, count, scale, offset, result + start);
+  }
+}
+
+/*
+   Convert an image once for applying many sources to it. With Unique,
+   images with few enough distinct colors keep the lαβ of each color and a
+   palette index for each pixel; others keep the lαβ of every pixel.
+*/
+template<class Pipeline, bool Unique>
+static void labconvert(const Pixel *pixels, long n, LabImage &image){
+  Pipeline p;
+
+  LabMoments moments;
+  UniqueColors table;
+  image.indices.resize(Unique ? n : 0);
+  if(Unique && table.add(pixels, n, image.indices.data(), UNIQUEFRACTION)){
+    image.lab.resize(3 * table.size());
+    convertmoments(table.colors(), table.size(), table.colorcounts(), p,
+                   image.lab.data(), moments);
+  }
+  else{
+    image.indices.clear();
+    image.lab.resize(3 * n);
+    convertmoments(pixels, n, NULL, p, image.lab.data(), moments);
+  }
+  image.stats = moments.stats();
+}
+
+/*
+   Apply to pixels start to start + n - 1 of a LabImage. A palette is
+   mapped whole when it has no more colors than there are pixels to apply;
+   otherwise, as for a band of a large image, the lαβ of each pixel's color
+   is gathered and applied like a pixel of its own.
+*/
+template<class Pipeline>
+static void labapplyimage(const LabStats &source, const LabImage &dest,
+                          long start, long n, Pixel *result){
+  Pipeline p;
+  float scale[3], offset[3];
+  transfercoefficients(source, dest.stats, scale, offset);
+
+  const float *lab = dest.lab.data();
+  long ncolors = long(dest.lab.size() / 3);
+  if(dest.indices.empty())
+    lab += 3 * start;
+  else if(ncolors <= n){
+    applypalette(lab, ncolors, dest.indices.data() + start, n, scale, offset, p, result);
+    return;
+  }
+
+  float block[3 * BLOCK];
+  for(long first = 0; first < n; first += BLOCK){
+    int count = int(min(long(BLOCK), n - first));
+    const float *blocklab = lab + 3 * first;
+    if(!dest.indices.empty()){
+      const uint32_t *indices = dest.indices.data() + start + first;
+      for(int i = 0; i < count; i++)
+        for(int c = 0; c < 3; c++)
+          block[3 * i + c] = lab[3 * indices[i] + c];
+      blocklab = block;
+    }
+    p.apply(blocklab, count, scale, offset, result + first);
+  }
+}
+
+#define KERNEL(name, Pipeline, Unique) {name, labstats<Pipeline, Unique>, labapply<Pipeline, Unique>, \
+                                        labconvert<Pipeline, Unique>, labapplyimage<Pipeline>}
+
+/*
+   Look up a kernel by name: "reference", "fast" (fastmath.h at the
+   compiled-in precision), "fast-unique" or any entry of transferkernels.
+   Kernels ending in -unique take their statistics from the distinct colors.
+   Returns NULL if there is no such kernel.
+*/
+const TransferKernel *findkernel(const string &name){
+  static const TransferKernel reference = {"reference", referencestats, referenceapply,
+                                           referenceconvert, referenceapplyimage};
+  typedef FloatPipeline<FastMath<FASTMATH_PRECISION> > FastPipeline;
+  static const TransferKernel fast = KERNEL("fast", FastPipeline, false);
+  static const TransferKernel fastunique = KERNEL("fast-unique", FastPipeline, true);
+
+  if(name == reference.name)
+    return &reference;
+  if(name == fast.name)
+    return &fast;
+  if(name == fastunique.name)
+    return &fastunique;
+  for(int k = 0; k < ntransferkernels; k++)
+    if(name == transferkernels[k].name)
+      return &transferkernels[k];
+  return NULL;
+}
+
+const TransferKernel transferkernels[] = {
+  KERNEL("float", FloatPipeline<LibmMath>, false),
+  KERNEL("fast-low", FloatPipeline<FastMath<FASTMATH_LOW> >, false),
+  KERNEL("fast-medium", FloatPipeline<FastMath<FASTMATH_MEDIUM> >, false),
+  KERNEL("fast-high", FloatPipeline<FastMath<FASTMATH_HIGH> >, false),
+  KERNEL("float-unique", FloatPipeline<LibmMath>, true),
+  KERNEL("fast-low-unique", FloatPipeline<FastMath<FASTMATH_LOW> >, true),
+  KERNEL("fast-medium-unique", FloatPipeline<FastMath<FASTMATH_MEDIUM> >, true),
+  KERNEL("fast-high-unique", FloatPipeline<FastMath<FASTMATH_HIGH> >, true),
+  KERNEL("fixed", FixedPipeline, false),
+  KERNEL("fixed-unique", FixedPipeline, true),
+  KERNEL("ycbcr", SpacePipeline<YCbCrSpace>, false),
+  KERNEL("ycbcr-unique", SpacePipeline<YCbCrSpace>, true),
+  KERNEL("cielab", SpacePipeline<CielabSpace<FastMath<FASTMATH_PRECISION> > >, false),
+  KERNEL("cielab-unique", SpacePipeline<CielabSpace<FastMath<FASTMATH_PRECISION> > >, true),
+  KERNEL("oklab", SpacePipeline<OklabSpace<FastMath<FASTMATH_PRECISION> > >, false),
+  KERNEL("oklab-unique", SpacePipeline<OklabSpace<FastMath<FASTMATH_PRECISION> > >, true),
+};
+const int ntransferkernels = sizeof(transferkernels) / sizeof(transferkernels[0]);
+
+//
+// Statistics helpers and the ColorTransfer object
+//
+double labstddev(const LabStats &stats, int channel){
+  return sqrt(stats.m2[channel] / stats.count);
+}
+
+/*
+   The covered pixels are gathered into one buffer so that the kernel sees
+   a single run.
+*/
+void imagestats(const TransferKernel *kernel, const Pixel *pixels, const Mask &mask,
+                LabStats &stats){
+  Pixel *covered = poolnew<Pixel>(mask.covered());
+  mask.gather(pixels, covered);
+  kernel->stats(covered, mask.covered(), stats);
+  poolfree(covered);
+}
+
+ColorTransfer::ColorTransfer(const TransferKernel *k){
+  kernel = k ? k : findkernel("fast");
+  havestats = false;
+}
+
+/*
+   Compute the statistics of the source and destination images with the
+   kernel's statistics stage.
+*/
+void ColorTransfer::computestats(const Pixel *sourcepixels, long nsource,
+                                 const Pixel *destpixels, long ndest){
+  kernel->stats(sourcepixels, nsource, source);
+  kernel->stats(destpixels, ndest, dest);
+  havestats = true;
+}
+
+/*
+   The same from only the covered pixels.
+*/
+void ColorTransfer::computestats(const Pixel *sourcepixels, const Mask &sourcemask,
+                                 const Pixel *destpixels, const Mask &destmask){
+  imagestats(kernel, sourcepixels, sourcemask, source);
+  imagestats(kernel, destpixels, destmask, dest);
+  havestats = true;
+}
+
+/*
+   Use statistics computed elsewhere, for instance by another ColorTransfer
+   with the same kernel.
+*/
+void ColorTransfer::setstats(const LabStats &sourcestats, const LabStats &deststats){
+  source = sourcestats;
+  dest = deststats;
+  havestats = true;
+}
+
+/*
+   Transfer n destination pixels into result. The pixels need not be the
+   ones the destination statistics came from, so an image can be applied
+   a band or a tile at a time.
+*/
+bool ColorTransfer::apply(const Pixel *pixels, Pixel *result, long n) const{
+  if(!havestats)
+    return false;
+  kernel->apply(source, dest, pixels, result, n);
+  return true;
+}
+
+/*
+   Transfer only the pixels the mask covers: they are gathered, transferred
+   in place, and their r, g and b scattered back to result.
+*/
+bool ColorTransfer::apply(const Pixel *pixels, const Mask &mask, Pixel *result) const{
+  if(!havestats)
+    return false;
+  Pixel *covered = poolnew<Pixel>(mask.covered());
+  mask.gather(pixels, covered);
+  kernel->apply(source, dest, covered, covered, mask.covered());
+  mask.scatter(covered, result);
+  poolfree(covered);
+  return true;
+}
+
+/*
+   Convert the destination to lαβ once. The LabImage holds the destination
+   statistics, so a transfer from each source needs only the statistics of
+   the source and the apply.
+*/
+void ColorTransfer::convert(const Pixel *destpixels, long ndest, LabImage &destimage) const{
+  kernel->convert(destpixels, ndest, destimage);
+}
+
+void ColorTransfer::computestats(const Pixel *sourcepixels, long nsource, const LabImage &destimage){
+  kernel->stats(sourcepixels, nsource, source);
+  dest = destimage.stats;
+  havestats = true;
+}
+
+bool ColorTransfer::apply(const LabImage &destimage, Pixel *result) const{
+  return apply(destimage, 0, long(destimage.stats.count), result);
+}
+
+bool ColorTransfer::apply(const LabImage &destimage, long start, long n, Pixel *result) const{
+  if(!havestats)
+    return false;
+  kernel->applyimage(source, destimage, start, n, result);
+  return true;
+}
@@ -0,0 +1,136 @@
+/*
+*   Color transfer library
+*
+*   The lαβ transfer of Reinhard et al. runs in two stages: statistics of
+*   the source and destination images, then an apply stage that moves every
+*   destination pixel to the source statistics. A ColorTransfer object holds
+*   the kernel and the statistics of one transfer, and the only global state
+*   in the library is the buffer pool (pool.h), which locks, so separate
+*   objects can be used from separate threads.
+*
+*   The reference kernel is the original double-precision implementation.
+*   Every faster kernel is registered in the transferkernels table so that
+*   ctbench can measure it against the reference. The ycbcr, cielab and
+*   oklab kernels do the same transfer in another color space
+*   (colorspace.h); LabStats and LabImage then hold values of that space.
+*/
+
+#ifndef TRANSFER_H
+#define TRANSFER_H
+
+#include "pool.h"
+
+#include <string>
+#include <vector>
+#include <stdint.h>
+
+struct Pixel { // defines a pixel structure
+  unsigned char r,g,b,a;
+};
+
+//
+// Per channel lαβ statistics of an image: the pixel count, the means, and
+// the sums of squared differences from the means.
+//
+struct LabStats{
+  double count;
+  double mean[3];
+  double m2[3];
+};
+
+double labstddev(const LabStats &stats, int channel);
+
+//
+// An image converted to lαβ once, so that many sources can be applied to
+// it. lab holds the lαβ of every pixel, or with a palette, the lαβ of every
+// distinct color and indices the palette index of every pixel.
+//
+struct LabImage{
+  LabStats stats;
+  PoolVector<float> lab;
+  PoolVector<uint32_t> indices;
+};
+
+//
+// A kernel has a statistics and an apply stage. stats computes the statistics of n pixels.
+// apply moves n destination pixels from the dest statistics to the source
+// statistics and writes the r, g and b channels of result; alpha is
+// untouched, and result may be the same buffer as pixels. convert and
+// applyimage do the same for a destination kept as a LabImage.
+//
+typedef void (*StatsFunc)(const Pixel *pixels, long n, LabStats &stats);
+typedef void (*ApplyFunc)(const LabStats &source, const LabStats &dest,
+                          const Pixel *pixels, Pixel *result, long n);
+typedef void (*ConvertFunc)(const Pixel *pixels, long n, LabImage &image);
+typedef void (*ApplyImageFunc)(const LabStats &source, const LabImage &dest,
+                               long start, long n, Pixel *result);
+
+struct TransferKernel{
+  const char *name;
+  StatsFunc stats;
+  ApplyFunc apply;
+  ConvertFunc convert;
+  ApplyImageFunc applyimage;
+};
+
+// the color space matrices of Reinhard et al.
+extern const double RGBTOLMS[3][3];
+extern const double LMSTORGB[3][3];
+
+void referencelab(const Pixel &p, double lab[3]);
+void referencetransfer(const Pixel *source, long nsource,
+                       const Pixel *dest, Pixel *result, long ndest);
+
+const TransferKernel *findkernel(const std::string &name);
+
+// fast kernels, not including the reference
+extern const TransferKernel transferkernels[];
+extern const int ntransferkernels;
+
+class Mask;
+
+// the statistics of only the pixels the mask covers, with the kernel's statistics stage
+void imagestats(const TransferKernel *kernel, const Pixel *pixels, const Mask &mask,
+                LabStats &stats);
+
+//
+// One transfer from a source to a destination image. computestats must be
+// called before apply; after that the const members, apply included, may
+// be called from several threads at once.
+//
+class ColorTransfer{
+private:
+  const TransferKernel *kernel;
+  LabStats source, dest;
+  bool havestats;
+
+public:
+  ColorTransfer(const TransferKernel *k = NULL);   // NULL is the fast kernel
+
+  const TransferKernel *transferkernel() const { return kernel; }
+
+  void computestats(const Pixel *sourcepixels, long nsource,
+                    const Pixel *destpixels, long ndest);
+  // statistics of only the pixels each mask covers
+  void computestats(const Pixel *sourcepixels, const Mask &sourcemask,
+                    const Pixel *destpixels, const Mask &destmask);
+  void setstats(const LabStats &sourcestats, const LabStats &deststats);
+  bool ready() const { return havestats; }
+  const LabStats &sourcestats() const { return source; }
+  const LabStats &deststats() const { return dest; }
+
+  // returns false if there are no statistics yet
+  bool apply(const Pixel *pixels, Pixel *result, long n) const;
+  // apply to only the covered pixels, leaving the others of result as they are
+  bool apply(const Pixel *pixels, const Mask &mask, Pixel *result) const;
+
+  // The same for a destination converted once with convert, which must
+  // have been made by a ColorTransfer with the same kernel
+  void convert(const Pixel *destpixels, long ndest, LabImage &destimage) const;
+  void computestats(const Pixel *sourcepixels, long nsource, const LabImage &destimage);
+  bool apply(const LabImage &destimage, Pixel *result) const;
+  // only pixels start to start + n - 1 of the LabImage
+  bool apply(const LabImage &destimage, long start, long n, Pixel *result) const;
+};
+
+#endif
@@ -0,0 +1,118 @@
+/*
+*   Table of the distinct colors in 8-bit images
+*/
+
+#include "uniquecolors.h"
+
+#include <cstring>
+#include <algorithm>
+
+using namespace std;
+
+static const uint64_t EMPTY = ~uint64_t(0);
+static const int INITIALBITS = 12;
+
+// Fibonacci hashing: the top bits of the product mix all three channels
+static inline long colorhash(uint32_t key, int bits){
+  return long((key * 2654435769u) >> (32 - bits));
+}
+
+UniqueColors::UniqueColors(): slots(NULL), bits(0), capacity(0), counted(0){
+  clear();
+}
+
+UniqueColors::~UniqueColors(){
+  poolfree(slots);
+}
+
+void UniqueColors::clear(){
+  poolfree(slots);
+  bits = INITIALBITS;
+  capacity = 1L << bits;
+  slots = poolnew<uint64_t>(capacity);
+  memset(slots, 0xff, capacity * sizeof(uint64_t));
+  palette.clear();
+  counts.clear();
+  counted = 0;
+}
+
+/*
+   Return the number of the color key, adding it with a zero count if it
+   is new. The table is kept at most half full.
+*/
+uint32_t UniqueColors::number(uint32_t key){
+  long mask = capacity - 1;
+  for(long i = colorhash(key, bits);; i = (i + 1) & mask){
+    if(slots[i] == EMPTY){
+      if(2 * (palette.size() + 1) > size_t(capacity)){
+        grow();
+        return number(key);
+      }
+      uint32_t n = uint32_t(palette.size());
+      slots[i] = uint64_t(key) << 32 | n;
+      Pixel p = {(unsigned char)(key >> 16), (unsigned char)(key >> 8), (unsigned char)key, 255};
+      palette.push_back(p);
+      counts.push_back(0);
+      return n;
+    }
+    if(uint32_t(slots[i] >> 32) == key)
+      return uint32_t(slots[i]);
+  }
+}
+
+void UniqueColors::grow(){
+  uint64_t *oldslots = slots;
+  long oldcapacity = capacity;
+
+  bits++;
+  capacity = 1L << bits;
+  slots = poolnew<uint64_t>(capacity);
+  memset(slots, 0xff, capacity * sizeof(uint64_t));
+
+  long mask = capacity - 1;
+  for(long j = 0; j < oldcapacity; j++){
+    if(oldslots[j] == EMPTY)
+      continue;
+    long i = colorhash(uint32_t(oldslots[j] >> 32), bits);
+    while(slots[i] != EMPTY)
+      i = (i + 1) & mask;
+    slots[i] = oldslots[j];
+  }
+
+  poolfree(oldslots);
+}
+
+/*
+   Runs of one color, common in skies and graphics, only look up the table
+   once. Photographs with mostly distinct neighboring colors are caught by
+   the first check, before much time goes into the table.
+*/
+bool UniqueColors::add(const Pixel *pixels, long n, uint32_t *indices, double maxfraction){
+  for(long start = 0; start < n; start += CHECKPIXELS){
+    long end = min(start + CHECKPIXELS, n);
+    uint32_t lastkey = 0xffffffff;
+    uint32_t lastnumber = 0;
+    long run = 0;
+
+    for(long i = start; i < end; i++){
+      uint32_t key = uint32_t(pixels[i].r) << 16 | uint32_t(pixels[i].g) << 8 | pixels[i].b;
+      if(key != lastkey){
+        if(run > 0)
+          counts[lastnumber] += run;
+        lastnumber = number(key);
+        lastkey = key;
+        run = 0;
+      }
+      run++;
+      if(indices)
+        indices[i] = lastnumber;
+    }
+    if(run > 0)
+      counts[lastnumber] += run;
+
+    counted += end - start;
+    if(size() > maxfraction * counted)
+      return false;
+  }
+  return true;
+}
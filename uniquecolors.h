@@ -0,0 +1,53 @@
+/*
+*   Table of the distinct colors in 8-bit images
+*/
+
+#ifndef UNIQUECOLORS_H
+#define UNIQUECOLORS_H
+
+#include "transfer.h"
+
+#include <stdint.h>
+#include <vector>
+
+//
+// Counts how often each 24-bit RGB color occurs, ignoring alpha. Colors are
+// numbered in the order they are first seen. The hash table is
+// open-addressed on the color, so its memory grows with the number of
+// distinct colors rather than with the image size or 2^24.
+//
+class UniqueColors{
+public:
+  static const long CHECKPIXELS = 65536;
+
+private:
+  uint64_t *slots;    // color << 32 | number, or EMPTY
+  int bits;
+  long capacity;      // 2^bits
+  std::vector<Pixel> palette;
+  std::vector<long> counts;
+  long counted;       // pixels added so far
+
+  uint32_t number(uint32_t key);
+  void grow();
+
+public:
+  UniqueColors();
+  ~UniqueColors();
+
+  //
+  // Count the colors of n pixels. If indices is not NULL the number
+  // of each pixel's color is stored there. Returns false, leaving the
+  // table incomplete, once there are more than maxfraction colors per
+  // pixel counted so far, checked every CHECKPIXELS pixels and at the end.
+  //
+  bool add(const Pixel *pixels, long n, uint32_t *indices = NULL,
+           double maxfraction = 1.0);
+  void clear();
+
+  long size() const { return long(palette.size()); }
+  const Pixel *colors() const { return palette.data(); }  // alpha is 255
+  const long *colorcounts() const { return counts.data(); }
+};
+
+#endif